@@ -0,0 +1,241 @@
+#!/bin/sh
+#
+# Runs resLoadSIM on a fixed set of synthetic scenarios built from the
+# example data and writes one JSON object per scenario to the file
+# 'results.jsonl' in the working directory:
+#
+#   {"scenario": ..., "households": ..., "days": ..., "processes": ...,
+#    "threads": ..., "steps": ..., "seconds": ..., "steps_per_second": ...,
+#    "household_steps_per_second": ..., "peak_rss_mb": ...,
+#    "phases": {"simulation": ..., "location": ..., ...},
+#    "prerun_phases": {"prerun": ..., "prerun_1st_pass": ..., ...}}
+#
+# 'seconds' is the run time of the simulation without the pre-simulation
+# runs, the phases are the run times measured by resLoadSIM itself
+# (profiling = 1, see the file 'run_times'), both are the maximum over
+# all processes. 'phases' holds the simulation and the phases it
+# contains, 'prerun_phases' the pre-simulation runs and their passes.
+# The seed is fixed, so each scenario simulates the same households every
+# time.
+#
+# With -c every scenario is simulated a second time with one process and
+# one thread (in the subdirectory 'serial'), and the result files of both
+# runs must be identical. The example configuration sends households on
+# vacation, so this also checks that the choice of these households
+# doesn't depend on the number of processes.
+#
+# usage: run_benchmarks.sh [-n households] [-d days] [-t threads]
+#                          [-p processes -m mpi_launcher] [-w work_dir]
+#                          [-s "scenario ..."] [-c] resLoadSIM example_dir
+#
+# The MPI launcher is given without the number of processes,
+# e.g. -p 4 -m "mpiexec -n". Scenarios:
+#
+#   households            the example configuration
+#   heating               simulate_heating = TRUE
+#   control_1 .. control_4  peak shaving, a given load profile,
+#                         compensation of deviations, price signals
+#   battery_0 .. battery_4  battery charging strategy 0 .. 4 with solar
+#                         modules in half of the households
+#   powerflow             built-in power flow solver every 15 timesteps
+#                         with a case file created by resLoadSIM
+#                         (skipped with more than one process)
+
+households=1000
+days=2
+threads=1
+processes=1
+launcher=
+work_dir=bench
+check=0
+scenarios="households heating control_1 control_2 control_3 control_4
+           battery_0 battery_1 battery_2 battery_3 battery_4 powerflow"
+
+while getopts n:d:t:p:m:w:s:c option
+do
+    case $option in
+        n) households=$OPTARG ;;
+        d) days=$OPTARG ;;
+        t) threads=$OPTARG ;;
+        p) processes=$OPTARG ;;
+        m) launcher=$OPTARG ;;
+        w) work_dir=$OPTARG ;;
+        s) [ -n "$OPTARG" ] && scenarios=$OPTARG ;;
+        c) check=1 ;;
+        *) exit 1 ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+
+if [ $# -ne 2 ]
+then
+    echo "usage: $0 [-n households] [-d days] [-t threads] [-p processes -m mpi_launcher] [-w work_dir] [-s \"scenario ...\"] [-c] resLoadSIM example_dir" >&2
+    exit 1
+fi
+if [ "$processes" -gt 1 ] && [ -z "$launcher" ]
+then
+    echo "$0: more than one process requires an MPI launcher (-m)" >&2
+    exit 1
+fi
+
+# Absolute paths, the simulations run in their own directories
+
+binary=`cd "\`dirname "$1"\`" && pwd`/`basename "$1"`
+example_dir=`cd "$2" && pwd` || exit 1
+mkdir -p "$work_dir" || exit 1
+work_dir=`cd "$work_dir" && pwd`
+results=$work_dir/results.jsonl
+: > "$results"
+status=0
+
+
+# edit file sed_script (sed -i is not portable)
+
+edit()
+{
+    sed "$2" "$1" > "$1.tmp" && mv "$1.tmp" "$1"
+}
+
+
+# Prepare the directory of scenario $1 and change into it
+
+prepare()
+{
+    rm -rf "$work_dir/$1"
+    mkdir -p "$work_dir/$1" && cd "$work_dir/$1" || exit 1
+    cp -R "$example_dir/countries" "$example_dir/locations" "$example_dir/resLoadSIM.json" . || exit 1
+    edit resLoadSIM.json "s/\"seed\": *[0-9]*/\"seed\": 1/
+                          s/\"num_threads\": *[0-9]*/\"num_threads\": $threads/
+                          s/\"profiling\": *[0-9]*/\"profiling\": 1/"
+
+    case $1 in
+        heating)
+            edit resLoadSIM.json 's/"simulate_heating": *[A-Za-z]*/"simulate_heating": TRUE/'
+            ;;
+        control_*)
+            mode=`echo $1 | sed 's/control_//'`
+            edit resLoadSIM.json "s/\"control\": *[0-9]*/\"control\": $mode/"
+            # control = 2 follows the load profile in the file 'profile' (minute and
+            # upper limit in kW, about 0.4 kW per household on average), control = 3
+            # compensates the relative deviations in 'delta' (every 15 minutes)
+            awk -v n=$households 'BEGIN {for (i=0; i<1440; i++) printf "%d %.6f\n", i, n*(0.4+0.2*sin(6.2831853*(i-480)/1440))}' > profile
+            awk 'BEGIN {for (i=0; i<96; i++) printf "%.6f\n", 0.1*sin(6.2831853*i/96)}' > delta
+            ;;
+        battery_*)
+            strategy=`echo $1 | sed 's/battery_//'`
+            method=2    # the production of the previous day as a forecast
+            [ $strategy -eq 0 ] && method=0
+            edit resLoadSIM.json "s/\"strategy\": *[0-9]*/\"strategy\": $strategy/
+                                  s/\"production_forecast_method\": *[0-9]*/\"production_forecast_method\": $method/"
+            for file in countries/*/households.json
+            do
+                edit $file '/"solar_module"/s/[0-9][0-9]*\.[0-9]*/50.00/g'
+            done
+            # strategy = 4 starts charging the batteries a number of hours after
+            # sunrise, which is given for each month in the file 'param'
+            echo "0.0 0.9 2.8 3.7 3.9 5.2 4.8 4.4 2.9 1.3 0.0 0.0" > param
+            ;;
+        powerflow)
+            edit resLoadSIM.json 's/"case_file_name": *"[^"]*"/"case_file_name": ""/
+                                  s/"step_size": *[0-9]*/"step_size": 15/
+                                  s/"solver": *[0-9]*/"solver": 0/'
+            ;;
+    esac
+}
+
+
+# Turn the table of the processes in 'run_times' into a JSON line
+
+report()
+{
+    timestep=`sed -n 's/.*"timestep_size": *\([0-9.]*\).*/\1/p' resLoadSIM.json`
+    awk -v scenario=$1 -v households=$households -v days=$days -v processes=$processes \
+        -v threads=$threads -v timestep=$timestep '
+        $1 == "rank" { for (i=2; i<=NF; i++) name[i] = $i; columns = NF; table = 1; next }
+        table && NF == columns {
+            for (i=2; i<=NF; i++) if ($i > max[i]) max[i] = $i
+        }
+        END {
+            if (!table) exit 1
+            steps = int (days*86400/timestep + 0.5)
+            for (i=2; i<=columns; i++)
+            {
+                if (name[i] == "simulation") seconds = max[i]
+                else if (name[i] == "rss_mb") rss = max[i]
+                if (name[i] ~ /^prerun/) prerun = prerun sprintf ("%s\"%s\": %.3f", prerun == "" ? "" : ", ", name[i], max[i])
+                else if (name[i] != "rss_mb") phases = phases sprintf ("%s\"%s\": %.3f", phases == "" ? "" : ", ", name[i], max[i])
+            }
+            if (seconds <= 0) seconds = 0.001
+            printf "{\"scenario\": \"%s\", \"households\": %d, \"days\": %d, \"processes\": %d, \"threads\": %d, ", scenario, households, days, processes, threads
+            printf "\"steps\": %d, \"seconds\": %.3f, \"steps_per_second\": %.1f, \"household_steps_per_second\": %.1f, ", steps, seconds, steps/seconds, steps*households/seconds
+            printf "\"peak_rss_mb\": %.1f, \"phases\": {%s}, \"prerun_phases\": {%s}}\n", rss, phases, prerun
+        }' run_times
+}
+
+
+# Simulate scenario $1 with one process and one thread and compare the result
+# files (not the input files, the logs and the run times)
+
+check()
+{
+    mkdir serial || return 1
+    cp -R countries locations resLoadSIM.json serial || return 1
+    for file in profile delta param
+    do
+        [ -f $file ] && cp $file serial
+    done
+    if ! (cd serial && edit resLoadSIM.json "s/\"num_threads\": *[0-9]*/\"num_threads\": 1/" &&
+          "$binary" -s $households $days > output 2>&1)
+    then
+        echo "$0: the serial run of scenario $1 failed, see $work_dir/$1/serial/output" >&2
+        return 1
+    fi
+    differ=
+    for file in serial/*
+    do
+        name=`basename $file`
+        case $name in
+            resLoadSIM.json|profile|delta|param|output|run_times*|*.log) continue ;;
+        esac
+        [ -f $file ] || continue
+        cmp -s $file $name || differ="$differ $name"
+    done
+    if [ -n "$differ" ]
+    then
+        echo "$0: the results of scenario $1 differ from a run with one process and one thread:$differ" >&2
+        return 1
+    fi
+}
+
+
+for scenario in $scenarios
+do
+    case $scenario in
+        households|heating|control_[1-4]|battery_[0-4]|powerflow) ;;
+        *) echo "$0: unknown scenario '$scenario'" >&2; status=1; continue ;;
+    esac
+    if [ $scenario = powerflow ] && [ "$processes" -gt 1 ]
+    then
+        echo "Skipping scenario powerflow, the power flow calculation runs with one process only" >&2
+        continue
+    fi
+    echo "Running scenario $scenario ($households households, $days days)" >&2
+    prepare $scenario
+    if [ "$processes" -gt 1 ]
+    then
+        $launcher $processes "$binary" -s $households $days > output 2>&1
+    else
+        "$binary" -s $households $days > output 2>&1
+    fi
+    if [ $? -ne 0 ] || ! report $scenario >> "$results"
+    then
+        echo "$0: scenario $scenario failed, see $work_dir/$scenario/output" >&2
+        status=1
+    elif [ $check -eq 1 ] && ! check $scenario
+    then
+        status=1
+    fi
+done
+
+cat "$results"
+exit $status
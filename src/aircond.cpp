@@ -50,8 +50,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 AirConditioner::AirConditioner (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     efficiency = get_random_number (config->aircon.min_eff, config->aircon.max_eff);
     max_cool_power = household->area * config->aircon.kW_per_m2;
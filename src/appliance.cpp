@@ -45,23 +45,16 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "appliance.H"
 #include "globals.H"
 
-int compare_double (double *val_1, double *val_2);
-
 
 template <class AP>
-void Appliance_CRTP<AP>::print_EEI (FILE *fp, AP *head, int num_apps)
+void Appliance_CRTP<AP>::print_EEI (FILE *fp, AP *head, int num)
 {
     double value[16];
-    AP *app = head;
 
     if (count[0]==0) return;
 
     for (int i=0; i<num_energy_classes; i++) value[i] = 0.;
-    for (int i=0; i<num_apps; i++)
-    {
-        value[app->energy_class] += app->consumption;
-        app = app->next_app;
-    }
+    for (int i=0; i<num; i++) value[head[i].energy_class] += head[i].consumption;
     for (int i=0; i<num_energy_classes; i++) fprintf (fp, " %lf", value[i]);
 }
 template void Appliance_CRTP<Computer>::print_EEI (FILE *fp, Computer *head, int num);
@@ -92,7 +85,7 @@ void Appliance_CRTP<AP>::print_consumption (FILE *fp, const char name[])
     if (count[0])
     {
         calc_consumption();
-        for (res=0; res<=k_max_residents; res++) medi[res] = median(res);
+        median (medi);
         if (rank == 0)
         {
             fprintf (fp, "%-20s", name);
@@ -182,9 +175,8 @@ template double Appliance_CRTP<HeatPump>::print_summary (FILE *fp, const char na
 template <class AP>
 void Appliance_CRTP<AP>::calc_consumption()
 {
-    AP *app = first_app;
     double consumption;
-    int res;
+    int i, res;
 
     for (res=0; res<=k_max_residents; res++)
     {
@@ -194,16 +186,17 @@ void Appliance_CRTP<AP>::calc_consumption()
         consumption_square[res] = 0.;
         hh_count[res] = 0;
     }
-    while (app)
+    i = 0;
+    while (i < num_apps)
     {
-        res = app->household->residents;
+        res = apps[i].household->residents;
         hh_count[0]++;
         hh_count[res]++;
-        consumption = app->consumption;
-        while (app->next_app && app->next_app->household == app->household)
+        consumption = apps[i].consumption;
+        while (i+1 < num_apps && apps[i+1].household == apps[i].household)
         {
-            app = app->next_app;
-            consumption += app->consumption;
+            i++;
+            consumption += apps[i].consumption;
         }
         consumption_sum[0] += consumption;
         consumption_square[0] += consumption*consumption;
@@ -213,7 +206,7 @@ void Appliance_CRTP<AP>::calc_consumption()
         consumption_square[res] += consumption*consumption;
         if (consumption < consumption_min[res]) consumption_min[res] = consumption;
         if (consumption > consumption_max[res]) consumption_max[res] = consumption;
-        app = app->next_app;
+        i++;
     }
 #ifdef PARALLEL
     MPI_Allreduce (MPI_IN_PLACE, consumption_min, k_max_residents+1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
@@ -237,65 +230,33 @@ double Appliance_CRTP<AP>::std_deviation (int res)
     else return 0.;
 }
 
+// The medians of the consumption per household (see calc_medians)
+
 template <class AP>
-double Appliance_CRTP<AP>::median (int res)
+void Appliance_CRTP<AP>::median (double median[])
 {
     double *values;
-    double median = 0, consumption;
-    int j;
-    AP *app;
-#ifdef PARALLEL
-    int num;
-    MPI_Status status;
-#endif
+    int *group;
+    int i, j;
 
-    if (count[res])
+    alloc_memory (&values, num_apps > 0 ? num_apps : 1, "Appliance_CRTP::median");
+    alloc_memory (&group, num_apps > 0 ? num_apps : 1, "Appliance_CRTP::median");
+    i = j = 0;
+    while (i < num_apps)
     {
-        alloc_memory (&values, hh_count[res], "Appliance_CRTP::median");
-        j=0;
-        app = first_app;
-        while (app)
-        {
-            if (app->household->residents == res || res == 0)
-            {
-                consumption = app->consumption;
-                while (app->next_app && app->next_app->household == app->household)
-                {
-                    app = app->next_app;
-                    consumption += app->consumption;
-                }
-                values[j] = consumption;
-                j++;
-            }
-            app = app->next_app;
-        }
-#ifdef PARALLEL
-        if (rank == 0)
-        {
-            for (int i=1; i<num_processes; i++)
-            {
-                MPI_Recv (&num, 1, MPI_INT, i, 0, MPI_COMM_WORLD, &status);
-                MPI_Recv (values+j, num, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &status);
-                j += num;
-            }
-        }
-        else
+        values[j] = apps[i].consumption;
+        while (i+1 < num_apps && apps[i+1].household == apps[i].household)
         {
-            MPI_Send (&j, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-            MPI_Send (values, j, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+            i++;
+            values[j] += apps[i].consumption;
         }
-        MPI_Barrier (MPI_COMM_WORLD);
-#endif
-        if (rank == 0)
-        {
-            qsort (values, (size_t)hh_count[res], sizeof(double), (int (*)(const void *, const void *))&compare_double);
-            if (hh_count[res]%2 == 1) median = values[hh_count[res]/2];
-            else median = (values[hh_count[res]/2] + values[hh_count[res]/2-1]) / 2.;
-        }
-        delete [] values;
-        return median;
+        group[j] = apps[i].household->residents;
+        j++;
+        i++;
     }
-    else return 0.;
+    calc_medians (values, group, j, hh_count, consumption_min, consumption_max, median);
+    delete [] values;
+    delete [] group;
 }
 
 
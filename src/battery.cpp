@@ -141,6 +141,7 @@ void Battery::simulate (double time, double power_household, double solar_power,
                     }
                     else
                     {
+#pragma omp critical (battery_param)
                         if (!param_fp)
                         {
                             open_file (&param_fp, "param", "r");
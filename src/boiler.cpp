@@ -50,8 +50,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Boiler::Boiler (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     status = OFF;
     heat_sum = 0.;
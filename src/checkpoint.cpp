@@ -0,0 +1,335 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef PARALLEL
+#include <mpi.h>
+#endif
+
+#include "appliance.H"
+#include "household.H"
+#include "producer.H"
+#include "battery.H"
+#include "output.H"
+#include "solarmodule.H"
+#include "solarcollector.H"
+#include "checkpoint.H"
+#include "profiler.H"
+#include "proto.H"
+#include "globals.H"
+
+
+// A checkpoint file starts with this header. The rest of the file consists of
+// the state of the global objects, the households with their appliances, the
+// producer and the output files, followed by the magic as end mark.
+
+static const char k_checkpoint_magic[4] = {'R', 'L', 'S', 'R'};
+static const int32_t k_checkpoint_version = 1;
+
+struct CheckpointHeader
+{
+    char magic[4];
+    int32_t version;
+    int32_t prerun;             // 1 = written after the pre-simulation runs
+    int32_t num_processes;
+    int32_t rank;
+    int32_t global_count;       // total number of households
+    uint32_t seed;
+    int32_t reserved;
+    double timestep_size;
+    double cur_time;
+};
+
+FILE *Checkpoint::restart_fp = NULL;
+FILE *Checkpoint::snapshot_fp = NULL;
+double Checkpoint::last_time = -1.;
+
+
+void write_checkpoint_data (FILE *fp, const void *data, size_t size)
+{
+    if (size > 0) fwrite (data, size, 1, fp);
+}
+
+
+void read_checkpoint_data (FILE *fp, void *data, size_t size)
+{
+    if (size > 0 && fread (data, size, 1, fp) != 1)
+    {
+        fprintf (stderr, "The checkpoint file is truncated or corrupt\n");
+        exit (1);
+    }
+}
+
+
+// Every process has its own checkpoint file <file_name>.<rank>, the one written
+// after the pre-simulation runs is called <file_name>.prerun.<rank>
+
+void Checkpoint::file_name (char name[], size_t size, bool prerun)
+{
+    snprintf (name, size, prerun ? "%s.prerun.%d" : "%s.%d", config->checkpoint.file_name, rank);
+}
+
+
+// The state of the simulation without the header. It is the same for
+// checkpoint files and snapshots.
+
+void Checkpoint::write_state (FILE *fp, class Output *output, class Producer *producer)
+{
+    RandomStream stream;
+    uint32_t seed;
+
+    get_random_state (&seed, &stream);
+    write_checkpoint_data (fp, &stream, sizeof (stream));
+    write_checkpoint_data (fp, sim_clock, sizeof (class Clock));
+    write_checkpoint_data (fp, &location->utc_offset, sizeof (location->utc_offset));
+    write_checkpoint_data (fp, &location->irradiance_integral, sizeof (location->irradiance_integral));
+    write_checkpoint_data (fp, &SolarModule::power_total_integral, sizeof (double));
+    write_checkpoint_data (fp, &SolarCollector::power_total_integral, sizeof (double));
+    write_checkpoint_data (fp, &Battery::power_from_grid_total_integral, sizeof (double));
+    write_checkpoint_data (fp, &Dishwasher::stop, sizeof (bool));
+    write_checkpoint_data (fp, &WashingMachine::stop, sizeof (bool));
+    write_checkpoint_data (fp, &TumbleDryer::stop, sizeof (bool));
+    Household::write_checkpoint (fp);
+    producer->write_checkpoint (fp);
+    output->write_checkpoint (fp);
+}
+
+
+void Checkpoint::read_state (FILE *fp, class Output *output, class Producer *producer, bool resume_files)
+{
+    RandomStream stream;
+    uint32_t seed;
+    double end_time = sim_clock->end_time;
+
+    get_random_state (&seed, &stream);
+    read_checkpoint_data (fp, &stream, sizeof (stream));
+    set_random_state (seed, &stream);
+    read_checkpoint_data (fp, sim_clock, sizeof (class Clock));
+    sim_clock->end_time = end_time;
+    read_checkpoint_data (fp, &location->utc_offset, sizeof (location->utc_offset));
+    read_checkpoint_data (fp, &location->irradiance_integral, sizeof (location->irradiance_integral));
+    location->update_year_ts (sim_clock->year);
+    read_checkpoint_data (fp, &SolarModule::power_total_integral, sizeof (double));
+    read_checkpoint_data (fp, &SolarCollector::power_total_integral, sizeof (double));
+    read_checkpoint_data (fp, &Battery::power_from_grid_total_integral, sizeof (double));
+    read_checkpoint_data (fp, &Dishwasher::stop, sizeof (bool));
+    read_checkpoint_data (fp, &WashingMachine::stop, sizeof (bool));
+    read_checkpoint_data (fp, &TumbleDryer::stop, sizeof (bool));
+    Household::read_checkpoint (fp);
+    producer->read_checkpoint (fp, resume_files);
+    output->read_checkpoint (fp, resume_files);
+}
+
+
+// A snapshot keeps the state of the simulation in an anonymous temporary
+// file, so that several scenarios can start from the same state one after
+// another. The file is deleted when it is closed.
+
+void Checkpoint::take_snapshot (class Output *output, class Producer *producer)
+{
+    if (snapshot_fp) fclose (snapshot_fp);
+    snapshot_fp = tmpfile();
+    if (snapshot_fp == NULL)
+    {
+        fprintf (stderr, "Unable to create a temporary file for the snapshot of the simulation\n");
+        exit (1);
+    }
+    write_state (snapshot_fp, output, producer);
+    if (fflush (snapshot_fp) || ferror (snapshot_fp))
+    {
+        fprintf (stderr, "Unable to write the snapshot of the simulation\n");
+        exit (1);
+    }
+}
+
+
+void Checkpoint::restore_snapshot (class Output *output, class Producer *producer)
+{
+    rewind (snapshot_fp);
+    read_state (snapshot_fp, output, producer, false);
+    last_time = sim_clock->cur_time;
+}
+
+
+void Checkpoint::drop_snapshot()
+{
+    if (snapshot_fp) fclose (snapshot_fp);
+    snapshot_fp = NULL;
+}
+
+
+// Open the checkpoint to restart from and check if it fits the current run.
+// The seed of the original run is needed before the households are set up.
+
+void Checkpoint::open (int num_households)
+{
+    struct CheckpointHeader header;
+    char name[k_name_length+32];
+    bool prerun = config->checkpoint.restart == 2;
+
+    file_name (name, sizeof (name), prerun);
+    restart_fp = fopen (name, "rb");
+    if (restart_fp == NULL)
+    {
+        fprintf (stderr, "Can't open checkpoint file '%s'\n", name);
+        exit (1);
+    }
+    read_checkpoint_data (restart_fp, &header, sizeof (header));
+    if (memcmp (header.magic, k_checkpoint_magic, sizeof (header.magic)) || header.version != k_checkpoint_version)
+    {
+        fprintf (stderr, "'%s' is not a checkpoint file of this version of resLoadSIM\n", name);
+        exit (1);
+    }
+    if (   header.prerun != (int32_t)prerun
+        || header.num_processes != num_processes
+        || header.rank != rank
+        || header.global_count != num_households
+        || header.timestep_size != config->timestep_size)
+    {
+        fprintf (stderr, "The checkpoint file '%s' does not match the current run\n", name);
+        fprintf (stderr, "(the number of households, processes and the timestep size must be the same)\n");
+        exit (1);
+    }
+    set_random_state (header.seed, NULL);
+}
+
+
+// Restore the state of the simulation from the checkpoint opened before.
+// The households, the producer and the output object must already exist.
+
+void Checkpoint::read (class Output *output, class Producer *producer)
+{
+    FILE *fp = restart_fp;
+    char magic[4];
+
+    read_state (fp, output, producer, config->checkpoint.restart == 1);
+    read_checkpoint_data (fp, magic, sizeof (magic));
+    if (memcmp (magic, k_checkpoint_magic, sizeof (magic)))
+    {
+        fprintf (stderr, "The checkpoint file is truncated or corrupt\n");
+        exit (1);
+    }
+    fclose (fp);
+    restart_fp = NULL;
+    last_time = sim_clock->cur_time;
+#ifdef PARALLEL
+    double min_time, max_time;
+    MPI_Allreduce (&last_time, &min_time, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce (&last_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    if (min_time != max_time)
+    {
+        if (rank == 0) fprintf (stderr, "The checkpoint files of the processes were written at different times\n");
+        MPI_Abort (MPI_COMM_WORLD, 1);
+    }
+#endif
+}
+
+
+// Write the state of the simulation. The checkpoint goes to a temporary file
+// first, which replaces the old checkpoint only if all processes succeeded.
+
+void Checkpoint::write (bool prerun, class Output *output, class Producer *producer)
+{
+    ProfileScope scope (PROFILE_CHECKPOINT);
+    struct CheckpointHeader header;
+    RandomStream stream;
+    char name[k_name_length+32], tmp_name[k_name_length+40];
+    FILE *fp;
+    int ok;
+
+    file_name (name, sizeof (name), prerun);
+    snprintf (tmp_name, sizeof (tmp_name), "%s.tmp", name);
+    memcpy (header.magic, k_checkpoint_magic, sizeof (header.magic));
+    header.version = k_checkpoint_version;
+    header.prerun = prerun;
+    header.num_processes = num_processes;
+    header.rank = rank;
+    header.global_count = Household::global_count;
+    get_random_state (&header.seed, &stream);
+    header.reserved = 0;
+    header.timestep_size = config->timestep_size;
+    header.cur_time = sim_clock->cur_time;
+
+    fp = fopen (tmp_name, "wb");
+    if (fp)
+    {
+        write_checkpoint_data (fp, &header, sizeof (header));
+        write_state (fp, output, producer);
+        write_checkpoint_data (fp, k_checkpoint_magic, sizeof (k_checkpoint_magic));
+        ok = !ferror (fp);
+        if (fclose (fp)) ok = 0;
+    }
+    else ok = 0;
+#ifdef PARALLEL
+    MPI_Allreduce (MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+#endif
+    if (ok)
+    {
+#ifdef _WIN32
+        remove (name);
+#endif
+        rename (tmp_name, name);
+    }
+    else
+    {
+        remove (tmp_name);
+        if (rank == 0) fprintf (stderr, "WARNING: Unable to write the checkpoint at %.2f h\n", sim_clock->cur_time/3600.);
+    }
+    last_time = sim_clock->cur_time;
+}
+
+
+// A periodic checkpoint is written at midnight every config->checkpoint.interval
+// days, counted from the beginning of the start day
+
+bool Checkpoint::due()
+{
+    if (   config->checkpoint.interval <= 0
+        || !sim_clock->midnight
+        || sim_clock->cur_time <= 0.
+        || sim_clock->cur_time == last_time) return false;
+    int day = (int)((sim_clock->cur_time + config->start.time*3600)/k_seconds_per_day + 0.5);
+    return day % config->checkpoint.interval == 0;
+}
@@ -49,8 +49,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 CirculationPump::CirculationPump (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     power.real = config->circpump.power_per_size * household->area;
     power.reactive = sqrt ((power.real/config->circpump.power_factor)*(power.real/config->circpump.power_factor)
@@ -47,8 +47,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Computer::Computer (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     power.real = config->computer.power;
     power.reactive = sqrt ((power.real/config->computer.power_factor)*(power.real/config->computer.power_factor)
@@ -67,7 +65,7 @@ void Computer::simulate()
     int rnd;
     double rahd, rt;
     
-    timer--;
+    timer -= wake_up();
     if (sim_clock->midnight)
     {
         total_duration = normal_distributed_random (config->computer.duration_mean, config->computer.duration_sigma);
@@ -150,4 +148,5 @@ void Computer::simulate()
         power_total[household->residents] += power.real * corr_factor;
         increase_consumption (corr_factor);
     }
+    if (status == OFF) sleep (steps_until (time_1, time_2));
 }
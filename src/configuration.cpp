@@ -65,17 +65,14 @@ Configuration::Configuration()
     strncpy (pv_data_file_name, "", sizeof (pv_data_file_name));
     strncpy (pv_forecast_file_name, "", sizeof (pv_forecast_file_name));
 
-    battery_charging.strategy = 0;
+    price[GRID].profiles = NULL;
+    price[SOLAR].profiles = NULL;
+    set_scenario_defaults();
     battery_charging.production_forecast_method = 0;
-    battery_charging.feed_in_limit = 0.5;
-    battery_charging.precharge_threshold = 0.1;
-    battery_charging.shared = false;
-
-    peak_shaving.relative = true;
-    peak_shaving.threshold = 85.0;
 
     powerflow.case_file_name[0] = '\0';
     powerflow.step_size = 0;
+    powerflow.solver = NEWTON_RAPHSON;
     powerflow.ov_control = false;
     powerflow.uv_control = false;
     powerflow.output_level = 1;
@@ -84,27 +81,21 @@ Configuration::Configuration()
     powerflow.uv_lower_limit = 0.910;
     powerflow.uv_upper_limit = 0.925;
 
-    price[GRID].num_profiles = 1;
-    price[GRID].profiles = new Profile;
-    price[GRID].profiles[0].begin[0] = 0.;
-    price[GRID].profiles[0].end[0] = 24.;
-    price[GRID].profiles[0].price[0] = 0.2;
-    price[GRID].profiles[0].length = 1;
-    price[GRID].seq_length = 1;
-    price[GRID].sequence[0] = 1;
-
-    price[SOLAR].num_profiles = 1;
-    price[SOLAR].profiles = new Profile;
-    price[SOLAR].profiles[0].begin[0] = 0.;
-    price[SOLAR].profiles[0].end[0] = 24.;
-    price[SOLAR].profiles[0].price[0] = 0.10;
-    price[SOLAR].profiles[0].length = 1;
-    price[SOLAR].seq_length = 1;
-    price[SOLAR].sequence[0] = 1;
-
-    control = 0;
     seed = 0;
+    num_threads = 1;
     output = 1;
+    binary_output = false;
+    output_thread = true;
+    exact_median = false;
+    load_balancing = true;
+    profiling = 0;
+    strcpy (checkpoint.file_name, "checkpoint");
+    checkpoint.interval = 0;
+    checkpoint.prerun = false;
+    checkpoint.restart = 0;
+    scenarios.count = 0;
+    scenarios.fork = false;
+    scenarios.max_processes = 0;
     start.day = 1;
     start.month = 1;
     start.year = 2015;
@@ -114,6 +105,7 @@ Configuration::Configuration()
     timestep_size = 60.0;
     simulate_heating = false;
     ventilation_model = false;
+    thermal_superposition = true;
     variable_load = false;
     comments_in_logfiles = true;
     energy_classes_2021 = true;
@@ -126,11 +118,8 @@ Configuration::Configuration()
         lookup_string ("location", location_name, sizeof (location_name));
         lookup_string ("pv_data_file_name", pv_data_file_name, sizeof (pv_data_file_name));
         lookup_string ("pv_forecast_file_name", pv_forecast_file_name, sizeof (pv_forecast_file_name));
-        lookup_integer (k_rls_json_file_name, "battery_charging.strategy", &battery_charging.strategy, 0, 4);
+        lookup_scenario_settings (k_rls_json_file_name);
         lookup_integer (k_rls_json_file_name, "battery_charging.production_forecast_method", &battery_charging.production_forecast_method, 0, 3);
-        lookup_decimal (k_rls_json_file_name, "battery_charging.feed_in_limit", &battery_charging.feed_in_limit, 0., 1.);
-        lookup_decimal (k_rls_json_file_name, "battery_charging.precharge_threshold", &battery_charging.precharge_threshold, 0., 1.);
-        lookup_boolean (k_rls_json_file_name, "battery_charging.shared", &battery_charging.shared);
         if (battery_charging.strategy && !battery_charging.production_forecast_method)
         {
             fprintf (stderr, "If battery_charging.strategy > 0, then production_forecast_method must be > 0 as well\n");
@@ -140,13 +129,14 @@ Configuration::Configuration()
                                        solar_production_reference_year, &num_ref_years, k_max_ref_years);
         lookup_string ("powerflow.case_file_name", powerflow.case_file_name, sizeof (powerflow.case_file_name));
         lookup_integer (k_rls_json_file_name, "powerflow.step_size", &powerflow.step_size, 0, INT_MAX);
+        lookup_integer (k_rls_json_file_name, "powerflow.solver", &powerflow.solver, 0, NUM_PF_SOLVERS-1);
 #ifndef HAVE_PF
 #ifndef HAVE_POWER
-        if (powerflow.step_size)
+        if (powerflow.step_size && powerflow.solver == PETSC)
         {
-            fprintf (stderr, "No powerflow solver installed (or not found by cmake)!\n");
+            fprintf (stderr, "No PETSc powerflow solver installed (or not found by cmake)!\n");
             fprintf (stderr, "You can either install 'pf' or 'power', which are part of the PETSc library, and then cmake/make resLoadSIM again,\n");
-            fprintf (stderr, "or you disable grid voltage control by setting powerflow.step_size = 0 in the configuration 'resLoadSIM.json'.\n");
+            fprintf (stderr, "or you use the built-in solver by setting powerflow.solver = 0 in the configuration 'resLoadSIM.json'.\n");
             exit(1);
         }
 #endif
@@ -158,14 +148,43 @@ Configuration::Configuration()
         lookup_decimal (k_rls_json_file_name, "powerflow.ov_upper_limit", &powerflow.ov_upper_limit, 1.0, DBL_MAX);
         lookup_decimal (k_rls_json_file_name, "powerflow.uv_lower_limit", &powerflow.uv_lower_limit, 0.0, 1.0);
         lookup_decimal (k_rls_json_file_name, "powerflow.uv_upper_limit", &powerflow.uv_upper_limit, 0.0, 1.0);
-        lookup_integer (k_rls_json_file_name, "control", &control, 0, 4);
-        lookup_boolean (k_rls_json_file_name, "peak_shaving.relative", &peak_shaving.relative);
-        if (peak_shaving.relative)
-            lookup_decimal (k_rls_json_file_name, "peak_shaving.threshold", &peak_shaving.threshold, 0., 100.);
-        else
-            lookup_decimal (k_rls_json_file_name, "peak_shaving.threshold", &peak_shaving.threshold, 0., DBL_MAX);
         lookup_integer (k_rls_json_file_name, "seed", &seed, 0, INT_MAX);
+        lookup_integer (k_rls_json_file_name, "num_threads", &num_threads, 0, k_max_threads);
         lookup_integer (k_rls_json_file_name, "output", &output, 0, 2);
+        lookup_boolean (k_rls_json_file_name, "binary_output", &binary_output);
+        lookup_boolean (k_rls_json_file_name, "output_thread", &output_thread);
+        lookup_boolean (k_rls_json_file_name, "exact_median", &exact_median);
+        lookup_boolean (k_rls_json_file_name, "load_balancing", &load_balancing);
+        lookup_integer (k_rls_json_file_name, "profiling", &profiling, 0, 2);
+        lookup_string ("checkpoint.file_name", checkpoint.file_name, sizeof (checkpoint.file_name));
+        lookup_integer (k_rls_json_file_name, "checkpoint.interval", &checkpoint.interval, 0, INT_MAX);
+        lookup_boolean (k_rls_json_file_name, "checkpoint.prerun", &checkpoint.prerun);
+        lookup_integer (k_rls_json_file_name, "checkpoint.restart", &checkpoint.restart, 0, 2);
+        if (checkpoint.restart == 1 && powerflow.step_size)
+        {
+            fprintf (stderr, "The state of the power flow solver is not part of a checkpoint, checkpoint.restart = 1 is not possible with powerflow.step_size > 0\n");
+            exit(1);
+        }
+        lookup_integer (k_rls_json_file_name, "scenarios.count", &scenarios.count, 0, INT_MAX);
+        lookup_boolean (k_rls_json_file_name, "scenarios.fork", &scenarios.fork);
+        lookup_integer (k_rls_json_file_name, "scenarios.max_processes", &scenarios.max_processes, 0, INT_MAX);
+        if (scenarios.count && checkpoint.restart == 1)
+        {
+            fprintf (stderr, "A simulation with scenarios cannot be resumed from a checkpoint (checkpoint.restart = 1)\n");
+            exit(1);
+        }
+        if (scenarios.count && powerflow.step_size)
+        {
+            fprintf (stderr, "Scenarios are not possible together with the power flow calculation (powerflow.step_size > 0)\n");
+            exit(1);
+        }
+#if defined(PARALLEL) || defined(_WIN32)
+        if (scenarios.fork)
+        {
+            fprintf (stderr, "scenarios.fork is not available in this build of resLoadSIM, the scenarios have to run one after another\n");
+            exit(1);
+        }
+#endif
         lookup_integer (k_rls_json_file_name, "start.day", &start.day, 1, 31);
         lookup_integer (k_rls_json_file_name, "start.month", &start.month, 1, 12);
         lookup_integer (k_rls_json_file_name, "start.year", &start.year, 1, 4800);
@@ -173,15 +192,15 @@ Configuration::Configuration()
         lookup_decimal (k_rls_json_file_name, "transient_time", &transient_time, 1.0, 10.0);
         lookup_integer (k_rls_json_file_name, "daylight_saving_time", &daylight_saving_time, 0, 2);
         lookup_decimal (k_rls_json_file_name, "timestep_size", &timestep_size, 1.0e-6, 3600.0);
-        lookup_price_table (k_rls_json_file_name, "price_grid", &price[GRID]);
-        lookup_price_table (k_rls_json_file_name, "price_solar", &price[SOLAR]);
         lookup_boolean (k_rls_json_file_name, "simulate_heating", &simulate_heating);
         lookup_boolean (k_rls_json_file_name, "ventilation_model", &ventilation_model);
+        lookup_boolean (k_rls_json_file_name, "thermal_superposition", &thermal_superposition);
         lookup_boolean (k_rls_json_file_name, "variable_load", &variable_load);
         lookup_boolean (k_rls_json_file_name, "comments_in_logfiles", &comments_in_logfiles);
         lookup_boolean (k_rls_json_file_name, "energy_classes_2021", &energy_classes_2021);
         delete [] dictionary;
     }
+    forecast_loaded = battery_charging.strategy > 0 && battery_charging.production_forecast_method == 3;
 
     // Initialize the location
     try
@@ -1361,6 +1380,100 @@ Configuration::~Configuration()
 }
 
 
+// The settings that may differ between the scenarios of a simulation (see
+// read_scenario). They act on the main simulation only, the pre-simulation
+// runs are done once with the settings of the base configuration.
+
+void Configuration::set_scenario_defaults()
+{
+    battery_charging.strategy = 0;
+    battery_charging.feed_in_limit = 0.5;
+    battery_charging.precharge_threshold = 0.1;
+    battery_charging.shared = false;
+
+    peak_shaving.relative = true;
+    peak_shaving.threshold = 85.0;
+
+    delete [] price[GRID].profiles;
+    price[GRID].num_profiles = 1;
+    price[GRID].profiles = new Profile;
+    price[GRID].profiles[0].begin[0] = 0.;
+    price[GRID].profiles[0].end[0] = 24.;
+    price[GRID].profiles[0].price[0] = 0.2;
+    price[GRID].profiles[0].length = 1;
+    price[GRID].seq_length = 1;
+    price[GRID].sequence[0] = 1;
+
+    delete [] price[SOLAR].profiles;
+    price[SOLAR].num_profiles = 1;
+    price[SOLAR].profiles = new Profile;
+    price[SOLAR].profiles[0].begin[0] = 0.;
+    price[SOLAR].profiles[0].end[0] = 24.;
+    price[SOLAR].profiles[0].price[0] = 0.10;
+    price[SOLAR].profiles[0].length = 1;
+    price[SOLAR].seq_length = 1;
+    price[SOLAR].sequence[0] = 1;
+
+    control = 0;
+}
+
+
+void Configuration::lookup_scenario_settings (const char *file_name)
+{
+    lookup_integer (file_name, "battery_charging.strategy", &battery_charging.strategy, 0, 4);
+    lookup_decimal (file_name, "battery_charging.feed_in_limit", &battery_charging.feed_in_limit, 0., 1.);
+    lookup_decimal (file_name, "battery_charging.precharge_threshold", &battery_charging.precharge_threshold, 0., 1.);
+    lookup_boolean (file_name, "battery_charging.shared", &battery_charging.shared);
+    lookup_integer (file_name, "control", &control, 0, 4);
+    lookup_boolean (file_name, "peak_shaving.relative", &peak_shaving.relative);
+    if (peak_shaving.relative)
+        lookup_decimal (file_name, "peak_shaving.threshold", &peak_shaving.threshold, 0., 100.);
+    else
+        lookup_decimal (file_name, "peak_shaving.threshold", &peak_shaving.threshold, 0., DBL_MAX);
+    lookup_price_table (file_name, "price_grid", &price[GRID]);
+    lookup_price_table (file_name, "price_solar", &price[SOLAR]);
+}
+
+
+// Switch to the settings of a scenario. The file resLoadSIM.json in the
+// scenario's directory needs to contain only the settings that differ from
+// the base configuration. Only the settings in lookup_scenario_settings()
+// are taken from it, everything else is ignored.
+
+void Configuration::read_scenario (const char directory[])
+{
+    char file_name[k_max_path];
+    struct stat st;
+
+    set_scenario_defaults();
+    create_dictionary (k_rls_json_file_name, NULL);
+    if (dictionary)
+    {
+        lookup_scenario_settings (k_rls_json_file_name);
+        delete [] dictionary;
+    }
+    snprintf (file_name, sizeof (file_name), "%s/%s", directory, k_rls_json_file_name);
+    if (stat (file_name, &st) == 0)
+    {
+        create_dictionary (file_name, NULL);
+        lookup_scenario_settings (file_name);
+        delete [] dictionary;
+    }
+    dictionary = NULL;
+    if (battery_charging.strategy && !battery_charging.production_forecast_method)
+    {
+        fprintf (stderr, "%s: If battery_charging.strategy > 0, then production_forecast_method must be > 0 as well\n", file_name);
+        exit(1);
+    }
+    if (battery_charging.strategy && battery_charging.production_forecast_method == 3 && !forecast_loaded)
+    {
+        fprintf (stderr, "%s: battery_charging.strategy > 0 with production_forecast_method = 3 needs a strategy > 0 in the base configuration,\n", file_name);
+        fprintf (stderr, "otherwise the solar forecast is not read\n");
+        exit(1);
+    }
+}
+
+
 void Configuration::print_log (int households, double days)
 {
     FILE *fp = NULL;
@@ -1421,15 +1534,18 @@ void Configuration::print_log (int households, double days)
     fprintf (fp, "\n  },\n");
     if (comments_in_logfiles)
     {
-        fprintf (fp, "\n// Use the PETSc power flow solver?\n");
+        fprintf (fp, "\n// Use a power flow solver?\n");
         fprintf (fp, "// The power flow solver is called every step_size timesteps.\n");
         fprintf (fp, "// If step_size = 0, it is not used at all.\n");
+        fprintf (fp, "// solver = 0: built-in Newton-Raphson solver\n");
+        fprintf (fp, "//          1: pf/power from the PETSc library\n");
+        fprintf (fp, "//          2: built-in backward/forward sweep (radial grids only, otherwise 0 is used)\n");
         fprintf (fp, "// ov_control and uv_control are used to turn on/off overvoltage and undervoltage control.\n");
         fprintf (fp, "// uv_lower_limit: grid voltage magnitude that triggers energy conservation mode in affected housholds\n");
         fprintf (fp, "// uv_upper_limit: if voltage levels recover above this limit, then energy conservation mode is turned off again stepwise\n");
         fprintf (fp, "// ov_lower_limit: if voltage falls below this limit, additional consumption is turned off again\n");
         fprintf (fp, "// ov_upper_limit: if grid voltage level exceeds this limit, household consumption is raised\n");
-        fprintf (fp, "// output_level = 0: no output related to the PETSc power flow solver\n");
+        fprintf (fp, "// output_level = 0: no output related to the power flow solver\n");
         fprintf (fp, "//                1: transformer files only\n");
         fprintf (fp, "//                2: transformer files, partial input/output of the power flow solver\n");
         fprintf (fp, "//                3: transformer files, full input/output of the power flow solver\n\n");
@@ -1437,6 +1553,7 @@ void Configuration::print_log (int households, double days)
     fprintf (fp, "  \"powerflow\":\n  {\n");
     log (fp, "case_file_name", powerflow.case_file_name, 4);
     log (fp, "step_size", powerflow.step_size, 4);
+    log (fp, "solver", powerflow.solver, 4);
     log (fp, "uv_control", powerflow.uv_control, 4);
     log (fp, "uv_lower_limit", powerflow.uv_lower_limit, 3, 4);
     log (fp, "uv_upper_limit", powerflow.uv_upper_limit, 3, 4);
@@ -1473,6 +1590,13 @@ void Configuration::print_log (int households, double days)
     }
     log (fp, "seed", seed, 2);
     if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Number of threads used by each process to simulate its households.\n");
+        fprintf (fp, "// If num_threads = 0, then all available cores will be used.\n");
+        fprintf (fp, "// Values >1 have an effect only if resLoadSIM was built with THREADS=ON.\n\n");
+    }
+    log (fp, "num_threads", num_threads, 2);
+    if (comments_in_logfiles)
     {
         fprintf (fp, "\n// The following output options are available:\n");
         fprintf (fp, "// 0 = all power data is written to a single file\n");
@@ -1480,6 +1604,70 @@ void Configuration::print_log (int households, double days)
         fprintf (fp, "// 2 = one file per appliance type + a single file with all data)\n\n");
     }
     log (fp, "output", output, 2);
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Write the time series (power, battery, gridbalance, trafo and bus files) in binary format?\n");
+        fprintf (fp, "// The binary files have the suffix '.bin' and start with a header describing the columns.\n\n");
+    }
+    log (fp, "binary_output", binary_output, 2);
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Write the time series in a separate thread, so that the simulation doesn't wait for the file system?\n");
+        fprintf (fp, "// Has an effect only if resLoadSIM was built with thread support (POSIX threads).\n\n");
+    }
+    log (fp, "output_thread", output_thread, 2);
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// The medians in the consumption files are estimated with a relative accuracy of %g.\n", k_median_accuracy);
+        fprintf (fp, "// With exact_median = true they are computed exactly, which takes more time for large simulations.\n\n");
+    }
+    log (fp, "exact_median", exact_median, 2);
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Distribute the households among the MPI processes so that all of them have about the same\n");
+        fprintf (fp, "// amount of work, instead of giving each process the same number of households?\n\n");
+    }
+    log (fp, "load_balancing", load_balancing, 2);
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Measure the run time of the phases of the simulation (household passes, producer, output, ...)?\n");
+        fprintf (fp, "// 0 = no, 1 = write the minimum, average and maximum over the processes to the file 'run_times',\n");
+        fprintf (fp, "// 2 = in addition write the times of each simulated day to 'run_times.timeline'\n\n");
+    }
+    log (fp, "profiling", profiling, 2);
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Checkpoints allow to resume a simulation, e.g. after a node failure. Each process writes\n");
+        fprintf (fp, "// the complete state of its households to the file '<file_name>.<rank>' every 'interval' days\n");
+        fprintf (fp, "// (0 = never). With prerun = true the state at the end of the pre-simulation runs is written\n");
+        fprintf (fp, "// to '<file_name>.prerun.<rank>'.\n");
+        fprintf (fp, "// restart = 0: start from scratch\n");
+        fprintf (fp, "//           1: resume from the last checkpoint and append to the existing output files\n");
+        fprintf (fp, "//           2: skip the pre-simulation runs and start from their checkpoint\n");
+        fprintf (fp, "// A restart needs the same configuration and the same number of households and processes.\n\n");
+    }
+    fprintf (fp, "  \"checkpoint\":\n  {\n");
+    log (fp, "file_name", checkpoint.file_name, 4);
+    log (fp, "interval", checkpoint.interval, 4);
+    log (fp, "prerun", checkpoint.prerun, 4);
+    log (fp, "restart", checkpoint.restart, 4);
+    fseek (fp, -2, SEEK_CUR);
+    fprintf (fp, "\n  },\n");
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Scenarios share the pre-simulation runs: the state at their end is kept, and the main\n");
+        fprintf (fp, "// simulation is run once for each scenario, starting from that state. Scenario i (1..count)\n");
+        fprintf (fp, "// writes its output to the directory 'scenario.<i>', where a resLoadSIM.json may change the\n");
+        fprintf (fp, "// settings control, peak_shaving, battery_charging (except production_forecast_method),\n");
+        fprintf (fp, "// price_grid and price_solar. With fork = true each scenario runs in a process of its own,\n");
+        fprintf (fp, "// at most max_processes at the same time (0 = no limit).\n\n");
+    }
+    fprintf (fp, "  \"scenarios\":\n  {\n");
+    log (fp, "count", scenarios.count, 4);
+    log (fp, "fork", scenarios.fork, 4);
+    log (fp, "max_processes", scenarios.max_processes, 4);
+    fseek (fp, -2, SEEK_CUR);
+    fprintf (fp, "\n  },\n");
     if (comments_in_logfiles) fprintf (fp, "\n// The date and time at which we want to start the simulation:\n\n");
     fprintf (fp, "  \"start\":\n  {\n");
     log (fp, "day", start.day, 4);
@@ -1507,6 +1695,12 @@ void Configuration::print_log (int households, double days)
     log (fp, "simulate_heating", simulate_heating, 2);
     if (comments_in_logfiles) fprintf (fp, "\n// Activate the ventilation model\n\n");
     log (fp, "ventilation_model", ventilation_model, 2);
+    if (comments_in_logfiles)
+    {
+        fprintf (fp, "\n// Calculate the heat demand from one solution of the thermal model per hour and the\n");
+        fprintf (fp, "// precomputed response to a unit heat flow? Otherwise up to 3 solutions are needed\n\n");
+    }
+    log (fp, "thermal_superposition", thermal_superposition, 2);
     if (comments_in_logfiles) fprintf (fp, "\n// Choose whether some appliances like washing machines can have a variable load\n\n");
     log (fp, "variable_load", variable_load, 2);
     if (comments_in_logfiles) fprintf (fp, "\n// Turn on/off comments in logfiles? Useful in case the log is going to be used as a JSON input\n\n");
@@ -2428,6 +2622,7 @@ void Configuration::lookup_price_table (const char *file_name, const char *group
     }
 
     snprintf (setting, sizeof(setting), "%s.sequence", group);
+    sequence_str[0] = '\0';
     lookup_string (setting, sequence_str, sizeof (sequence_str));
     leng = strlen (sequence_str);
     if (leng > 0)
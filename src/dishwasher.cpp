@@ -52,8 +52,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Dishwasher::Dishwasher (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     status = OFF;
     timer = 0;
@@ -107,7 +105,7 @@ void Dishwasher::simulate (double time)
     double daytime = sim_clock->daytime;
     double begin, length;
 
-    timer--;
+    timer -= wake_up();
 
     // Decide whether to turn on the machine, and when.
     // This is done every day at the same time and only for machines,
@@ -211,4 +209,5 @@ void Dishwasher::simulate (double time)
         increase_consumption();
         household->heat_loss_app += power.real*0.25;
     }
+    if (status == OFF && !smart_mode) sleep (timer > 0 ? timer : steps_per_day());
 }
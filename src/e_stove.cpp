@@ -49,8 +49,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 ElectricStove::ElectricStove (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     timer = 0;
     status = OFF;
@@ -68,7 +66,7 @@ void ElectricStove::simulate()
     int weekday = sim_clock->weekday;
     int percent;
 
-    timer--;
+    timer -= wake_up();
 
     if (sim_clock->midnight)
     {
@@ -159,4 +157,5 @@ void ElectricStove::simulate()
         household->heat_loss_app += power.real * 0.5 * corr_factor;
         household->increase_consumption_cooking (power.real * corr_factor * config->timestep_size/3600.);
     }
+    if (status == OFF) sleep (steps_until (time_1, time_2, time_3));
 }
@@ -53,8 +53,6 @@ E_Vehicle::E_Vehicle (Household *hh)
     static int num = 0;
     number = num++;
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     status = OFF;
     position = HOME;
@@ -216,7 +214,11 @@ void E_Vehicle::simulate()
     else if (almost_equal (daytime, arrival_time))
     {
         position = destination;
-        if (position == HOME) arr_counter++;
+        if (position == HOME)
+        {
+#pragma omp atomic
+            arr_counter++;
+        }
         if (position == SHOP) household->shopping_done = true;
 
         // calculate the energy used for driving depending on the nominal value of the car
@@ -397,13 +399,8 @@ void E_Vehicle::simulate()
 
 int E_Vehicle::create_smart_list (E_Vehicle ***list)
 {
-    E_Vehicle *ev = first_app;
     int i, num = 0;
-    while (ev)
-    {
-        if (ev->sg_enabled) num++;
-        ev = ev->next_app;
-    }
+    for (i=0; i<num_apps; i++) if (apps[i].sg_enabled) num++;
     try
     {
         *list = new class E_Vehicle* [num];
@@ -413,13 +410,8 @@ int E_Vehicle::create_smart_list (E_Vehicle ***list)
         fprintf (stderr, "Cannot allocate memory\n");
         exit (1);
     }
-    ev = first_app;
-    i = 0;
-    while (ev)
-    {
-        if (ev->sg_enabled) (*list)[i++] = ev;
-        ev = ev->next_app;
-    }
+    num = 0;
+    for (i=0; i<num_apps; i++) if (apps[i].sg_enabled) (*list)[num++] = apps+i;
     return num;
 }
 
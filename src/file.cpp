@@ -42,9 +42,21 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 #include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef PARALLEL
+#include <mpi.h>
+#endif
 
+#include "constants.H"
 #include "proto.H"
+#include "globals.H"
 
 
 int open_file (FILE **file, const char name[], const char mode[])
@@ -60,3 +72,175 @@ int open_file (FILE **file, const char name[], const char mode[])
     stat (name, &st);
     return (int)st.st_size;
 }
+
+
+// Open a file for a time series, i.e. rows of numbers with the time [h] in the
+// first column. If config->binary_output is set, the file gets the suffix '.bin'
+// and consists of a header and fixed-width rows of 8 byte floating point numbers
+// (native byte order). The header is made up of
+//   char     magic[4]        "RLSB"
+//   int32    version         1
+//   int32    num_columns
+//   int32    year, month, day    the date of the origin of the time column
+//   float64  hour            the time of day of the origin [h]
+//   float64  step            the time between two rows [s]
+//   char     names[num_columns][k_column_name_length]    zero padded column names
+
+void open_series_file (FILE **file, const char name[], int num_columns, const char *const columns[],
+                       int year, int month, int day, double hour, double step)
+{
+    if (config->binary_output)
+    {
+        char file_name[k_max_path];
+        int32_t header[5] = {1, num_columns, year, month, day};
+        char column_name[k_column_name_length];
+
+        snprintf (file_name, sizeof(file_name), "%s.bin", name);
+        open_file (file, file_name, "wb");
+        fwrite ("RLSB", 1, 4, *file);
+        fwrite (header, sizeof(int32_t), 5, *file);
+        fwrite (&hour, sizeof(double), 1, *file);
+        fwrite (&step, sizeof(double), 1, *file);
+        for (int i=0; i<num_columns; i++)
+        {
+            memset (column_name, 0, sizeof(column_name));
+            strncpy (column_name, columns[i], sizeof(column_name)-1);
+            fwrite (column_name, 1, sizeof(column_name), *file);
+        }
+    }
+    else open_file (file, name, "w");
+}
+
+
+// Reopen a time series file when a simulation is resumed from a checkpoint.
+// Everything written after the checkpoint is cut off, so that the file
+// continues with the first row after it.
+
+void reopen_series_file (FILE **file, const char name[], long size)
+{
+    char file_name[k_max_path];
+
+    if (config->binary_output) snprintf (file_name, sizeof(file_name), "%s.bin", name);
+    else snprintf (file_name, sizeof(file_name), "%s", name);
+    open_file (file, file_name, config->binary_output ? "r+b" : "r+");
+    truncate_file (*file, size);
+}
+
+
+// Cut a file opened for writing off at 'size' bytes and move to its end
+
+void truncate_file (FILE *file, long size)
+{
+    fflush (file);
+#ifdef _WIN32
+    int ret = _chsize (_fileno (file), size);
+#else
+    int ret = ftruncate (fileno (file), size);
+#endif
+    if (ret || fseek (file, 0, SEEK_END) || ftell (file) != size)
+    {
+        fprintf (stderr, "Unable to restore the size of an output file (%ld bytes).\n", size);
+        exit (1);
+    }
+}
+
+
+// Open a file which all processes write to together, like the files with one
+// line per household. In the parallel version every process writes its part
+// into a temporary file first, see close_shared_file().
+
+void open_shared_file (FILE **file, const char name[])
+{
+#ifdef PARALLEL
+    *file = tmpfile();
+    if (*file == NULL)
+    {
+        fprintf (stderr, "Can't open a temporary file for '%s'\n", name);
+        exit (1);
+    }
+#else
+    open_file (file, name, "w");
+#endif
+}
+
+
+// Close a file opened with open_shared_file(). The parts of all processes are
+// written with collective MPI-IO calls, each one at the offset given by the
+// sizes of the parts of the lower ranks (exclusive scan). So the file is the
+// same as if the processes had appended to it one after the other. A part is
+// written in chunks of k_shared_file_chunk bytes, all processes take part in
+// as many calls as the process with the largest part needs. Errors abort all
+// processes, as the others would wait for the failed one in the next call.
+
+void close_shared_file (FILE *file, const char name[])
+{
+#ifdef PARALLEL
+    MPI_File fh;
+    MPI_Offset size, offset = 0;
+    long long num_chunks, max_chunks;
+    char *buffer;
+
+    fflush (file);
+    size = ftell (file);
+    if (size < 0)
+    {
+        fprintf (stderr, "Unable to write file '%s'.\n", name);
+        MPI_Abort (MPI_COMM_WORLD, 1);
+    }
+    rewind (file);
+    MPI_Exscan (&size, &offset, 1, MPI_OFFSET, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) offset = 0;   // the result of MPI_Exscan is undefined on rank 0
+    num_chunks = (size + k_shared_file_chunk - 1)/k_shared_file_chunk;
+    MPI_Allreduce (&num_chunks, &max_chunks, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    if (MPI_File_open (MPI_COMM_WORLD, name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        fprintf (stderr, "Can't open file '%s'\n", name);
+        MPI_Abort (MPI_COMM_WORLD, 1);
+    }
+    MPI_File_set_size (fh, 0);
+    alloc_memory (&buffer, size < k_shared_file_chunk ? (int)size + 1 : k_shared_file_chunk, "close_shared_file");
+    for (long long i=0; i<max_chunks; i++)
+    {
+        int count = size > k_shared_file_chunk ? k_shared_file_chunk : (int)size;
+        if (fread (buffer, 1, (size_t)count, file) != (size_t)count
+            || MPI_File_write_at_all (fh, offset, buffer, count, MPI_CHAR, MPI_STATUS_IGNORE) != MPI_SUCCESS)
+        {
+            fprintf (stderr, "Unable to write file '%s'.\n", name);
+            MPI_Abort (MPI_COMM_WORLD, 1);
+        }
+        offset += count;
+        size -= count;
+    }
+    MPI_File_close (&fh);
+    fclose (file);
+    delete [] buffer;
+#else
+    if (fclose (file))
+    {
+        fprintf (stderr, "Unable to write file '%s'.\n", name);
+        exit (1);
+    }
+#endif
+}
+
+
+// Append one row to a time series file. In text format the columns marked
+// in 'integer_columns' (bit i for column i) are printed as integers.
+
+void write_series_row (FILE *file, const double values[], int num_columns, unsigned int integer_columns)
+{
+    if (config->binary_output)
+    {
+        fwrite (values, sizeof(double), num_columns, file);
+    }
+    else
+    {
+        for (int i=0; i<num_columns; i++)
+        {
+            if (i > 0) fputc (' ', file);
+            if (integer_columns & (1u << i)) fprintf (file, "%d", (int)values[i]);
+            else fprintf (file, "%lf", values[i]);
+        }
+        fputc ('\n', file);
+    }
+}
@@ -52,8 +52,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Freezer::Freezer (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     smart = false;
     sg_enabled = config->freezer.smartgrid_enabled > 0
@@ -196,13 +194,8 @@ void Freezer::simulate (double time)
 
 int Freezer::create_smart_list (Freezer ***list)
 {
-    Freezer *fz = first_app;
     int i, num = 0;
-    while (fz)
-    {
-        if (fz->sg_enabled) num++;
-        fz = fz->next_app;
-    }
+    for (i=0; i<num_apps; i++) if (apps[i].sg_enabled) num++;
     try
     {
         *list = new class Freezer* [num];
@@ -212,20 +205,15 @@ int Freezer::create_smart_list (Freezer ***list)
         fprintf (stderr, "Cannot allocate memory\n");
         exit (1);
     }
-    fz = first_app;
-    i = 0;
-    while (fz)
-    {
-        if (fz->sg_enabled) (*list)[i++] = fz;
-        fz = fz->next_app;
-    }
+    num = 0;
+    for (i=0; i<num_apps; i++) if (apps[i].sg_enabled) (*list)[num++] = apps+i;
     return num;
 }
 
 
 void Freezer::turn_off()
 {
-    if (status == ON && temperature < config->freezer.max_temperature)
+    if (can_turn_off())
     {
         status = OFF;
         household->decrease_power (power.real, power.reactive);
@@ -238,7 +226,7 @@ void Freezer::turn_off()
 
 void Freezer::turn_on()
 {
-    if (status == OFF && temperature > config->freezer.min_temperature)
+    if (can_turn_on())
     {
         status = ON;
         household->increase_power (power.real, power.reactive);
@@ -52,8 +52,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Fridge::Fridge (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     smart = false;
     sg_enabled = config->fridge.smartgrid_enabled > 0
@@ -215,13 +213,8 @@ void Fridge::simulate (double time)
 
 int Fridge::create_smart_list (Fridge ***list)
 {
-    Fridge *fr = first_app;
     int i, num = 0;
-    while (fr)
-    {
-        if (fr->sg_enabled) num++;
-        fr = fr->next_app;
-    }
+    for (i=0; i<num_apps; i++) if (apps[i].sg_enabled) num++;
     try
     {
         *list = new class Fridge* [num];
@@ -231,20 +224,18 @@ int Fridge::create_smart_list (Fridge ***list)
         fprintf (stderr, "Cannot allocate memory\n");
         exit (1);
     }
-    fr = first_app;
-    i = 0;
-    while (fr)
-    {
-        if (fr->sg_enabled) (*list)[i++] = fr;
-        fr = fr->next_app;
-    }
+    num = 0;
+    for (i=0; i<num_apps; i++) if (apps[i].sg_enabled) (*list)[num++] = apps+i;
     return num;
 }
 
 
+// Fridges are not simulated while the residents are on vacation,
+// so they must not be switched by the producer either
+
 void Fridge::turn_off()
 {
-    if (status == ON && temperature < config->fridge.max_temperature)
+    if (can_turn_off())
     {
         status = OFF;
         household->decrease_power (power.real, power.reactive);
@@ -257,7 +248,7 @@ void Fridge::turn_off()
 
 void Fridge::turn_on()
 {
-    if (status == OFF && temperature > config->fridge.min_temperature)
+    if (can_turn_on())
     {
         status = ON;
         household->increase_power (power.real, power.reactive);
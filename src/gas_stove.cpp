@@ -49,8 +49,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 GasStove::GasStove (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     timer = 0;
     status = OFF;
@@ -66,7 +64,7 @@ void GasStove::simulate()
     int weekday = sim_clock->weekday;
     int percent;
 
-    timer--;
+    timer -= wake_up();
 
     if (sim_clock->midnight)
     {
@@ -137,4 +135,5 @@ void GasStove::simulate()
         household->heat_loss_app += power.real*0.25;
         household->increase_consumption_cooking (power.real * config->timestep_size/3600.);
     }
+    if (status == OFF) sleep (steps_until (time_1, time_2, time_3));
 }
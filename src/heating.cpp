@@ -49,8 +49,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Heating::Heating (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     max_heat_power = hh->area * config->heating.kW_per_m2;
     status = OFF;
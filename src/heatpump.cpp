@@ -52,8 +52,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 HeatPump::HeatPump (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     efficiency = get_random_number (config->heatpump.min_eff, config->heatpump.max_eff);
     temp_hot = get_random_number (config->heatpump.min_temperature, config->heatpump.max_temperature);
@@ -130,12 +128,13 @@ void HeatPump::simulate()
 
 void HeatPump::correction_term (void)
 {
-    class HeatPump *app = first_app;
+    class HeatPump *app;
     class Household *hh;
     double fraction_SH, fraction_DHW;
 
-    while (app)
+    for (int i=0; i<num_apps; i++)
     {
+        app = apps+i;
         hh = app->household;
         if (hh->heat_source_type == SOLAR_COLLECTOR)
         {
@@ -144,6 +143,5 @@ void HeatPump::correction_term (void)
             fraction_DHW = hh->heat_storage->power_integral_DHW / (hh->heat_storage->power_integral_SH + hh->heat_storage->power_integral_DHW);
             hh->increase_consumption_DHW_tot_int (app->consumption * fraction_DHW, HEAT_PUMP);
         }
-        app = app->next_app;
     }
 }
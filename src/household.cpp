@@ -43,31 +43,34 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #ifdef PARALLEL
 #   include <mpi.h>
 #endif
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
 
 #include "element.H"
 #include "appliance.H"
 #include "household.H"
+#include "thermal.H"
 #include "solarmodule.H"
 #include "solarcollector.H"
 #include "battery.H"
 #include "producer.H"
 #include "heatsource.H"
 #include "heatstorage.H"
+#include "profiler.H"
+#include "threadtotals.H"
 #include "proto.H"
 #include "globals.H"
 
-int compare_double (double *val_1, double *val_2);
-static int compare_households_vacation (const void *h1, const void *h2);
-
 
 Household::Household()
 {
     double x;
     double percent;
-    int num_hh_per_category[k_max_residents];
     int limit[k_max_residents];
     static int counter = 0;
 
@@ -75,6 +78,11 @@ Household::Household()
     number = first_number + counter;
     counter++;
 
+    // Everything that is set up randomly for this household and its appliances
+    // is drawn from the household's own stream
+    init_random_stream (&rng, number);
+    select_random_stream (&rng);
+
     reduce_consumption = false;
     raise_consumption = false;
     rc_timestamp = DBL_MAX;
@@ -82,20 +90,10 @@ Household::Household()
     bedtime = k_seconds_per_day;
     feed_to_grid = 0.;
     vacation = 0;
+    steps_at_home = 0;
 
     // Determine the number of residents
-    int sum = 0;
-    for (int i=0; i<k_max_residents-1; i++)
-    { 
-        num_hh_per_category[i] = global_count * config->household.size_distribution[i] / 100.0; 
-        sum += num_hh_per_category[i];
-    }
-    num_hh_per_category[k_max_residents-1] = global_count - sum;
-    limit[0] = num_hh_per_category[0];
-    for (int i=1; i<k_max_residents; i++)
-    { 
-        limit[i] = limit[i-1] + num_hh_per_category[i]; 
-    }
+    size_limits (limit);
     for (int i=1; i<=k_max_residents; i++)
     {
         if (number <= limit[i-1])
@@ -153,8 +151,16 @@ Household::Household()
     heat_demand_DHW = 0.;
     //heat_loss_DHW = 0.20;
     heat_loss_DHW = 0.; // heat losses are handled in the boilers' simulation
-    for (int i=0; i<1440; i++) dhw_schedule[i] = DO_NOTHING;
-    first_timer = NULL;
+    dhw_table = table_DHW_weekday;
+    probability_sum = 0.;
+    dhw_schedule = NULL;
+    num_dhw_events = 0;
+    max_dhw_events = 0;
+    dhw_schedule_pos = 0;
+    dhw_event_pos = 0;
+    dhw_timer = NULL;
+    num_dhw_timers = 0;
+    max_dhw_timers = 0;
 
     // SOLARMODULE
 
@@ -208,10 +214,8 @@ Household::Household()
     solar_collector = NULL;
     heat_storage = NULL;
     heat_source = NULL;  // no oil, gas or district heating
-    a_matrix = NULL;
-    b_vector = NULL;
-    offsets = NULL;
-    area_tot = 0.;
+    heat_transfer_vent = 0.;
+    vent_initialized = false;
     heat_demand_SH = 0.;
 
     x = get_random_number (0., 100.);
@@ -488,6 +492,7 @@ Household::Household()
             distance [SHOP*NUM_DESTINATIONS+HOME] = x;
         }
     }
+    select_random_stream (NULL);
 }
 
 Household* Household::get_household_ptr (int id)
@@ -500,15 +505,19 @@ void Household::allocate_memory (int num_households)
 {
     global_count = num_households;
     local_count = num_households/num_processes + (rank < num_households%num_processes);
-    count[0] = local_count;
 #ifdef PARALLEL
-    MPI_Status status;
-    int next_first_number;
-    if (rank > 0) MPI_Recv (&first_number, 1, MPI_INT, rank-1, 1, MPI_COMM_WORLD, &status);
-    next_first_number = first_number + local_count;
-    if (rank < num_processes-1) MPI_Send (&next_first_number, 1, MPI_INT, rank+1, 1, MPI_COMM_WORLD);
+    if (config->load_balancing) balance_load();
+    else
+    {
+        int households_below = 0;
+        MPI_Exscan (&local_count, &households_below, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        if (rank > 0) first_number = 1 + households_below;
+    }
 #endif
+    count[0] = local_count;
     alloc_memory (&hh, local_count, "Household::allocate_memory");
+    ThreadTotals::allocate_memory();
+    link_appliances();
 #ifdef PARALLEL
     MPI_Allreduce (MPI_IN_PLACE, count, k_max_residents+1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
     MPI_Allreduce (MPI_IN_PLACE, &SolarModule::count, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
@@ -517,91 +526,367 @@ void Household::allocate_memory (int num_households)
 }
 
 
-Household::~Household()
+// The households are numbered 1 ... global_count in the order of their size:
+// 1-person households first, then 2-person households and so on. limit[i] is
+// the number of the last household with i+1 residents.
+
+void Household::size_limits (int limit[])
+{
+    int sum = 0;
+    for (int i=0; i<k_max_residents-1; i++)
+    {
+        limit[i] = sum + (int)(global_count * config->household.size_distribution[i] / 100.0);
+        sum = limit[i];
+    }
+    limit[k_max_residents-1] = global_count;
+}
+
+
+// The expected costs of simulating the household with the given number, in
+// units of the costs of a household without any appliances. The appliances
+// of a household are chosen randomly in its constructor, but the probabilities
+// depend on the number of residents and some appliances (boiler, freezer,
+// computers, tumble dryer and dishwasher) are always given to the households
+// at the beginning of each size group. So the costs of a range of households
+// depend on where it lies: the large households at the end have more lamps and
+// appliances, and so have the first households of each size group.
+
+double Household::expected_cost (int number, const int limit[])
+{
+    int res = 1;
+    while (res < k_max_residents && number > limit[res-1]) res++;
+
+    const int first = res > 1 ? limit[res-2] : 0;    // the last household of the next smaller size
+    const double share = global_count * config->household.size_distribution[res-1] / 100.0;
+    const double *leading[] = {config->household.prevalence.freezer,
+                               config->household.prevalence.computer,
+                               config->household.second_computer,
+                               config->household.prevalence.dryer,
+                               config->household.prevalence.dishwasher};
+    const double *drawn[] = {config->household.prevalence.aircon,
+                             config->household.prevalence.fridge,
+                             config->household.prevalence.wmachine,
+                             config->household.prevalence.vacuum,
+                             config->household.prevalence.circpump,
+                             config->household.prevalence.e_vehicle};
+    const double p_solar = config->household.prevalence.solar_module[res-1] / 100.;
+    const double p_tv = config->household.prevalence.tv[res-1] / 100.;
+    double appliances = 1.;   // electric or gas stove
+    double cost = 1.;
+
+    for (unsigned int i=0; i<sizeof(leading)/sizeof(leading[0]); i++)
+    {
+        if (number <= first + (int)(share * leading[i][res-1] / 100.0)) appliances += 1.;
+    }
+    for (unsigned int i=0; i<sizeof(drawn)/sizeof(drawn[0]); i++)
+    {
+        appliances += drawn[i][res-1] / 100.;
+    }
+    appliances += config->household.prevalence.fridge[res-1] / 100. * config->household.second_fridge[res-1] / 100.;
+    appliances += p_tv * (1. + config->household.second_tv[res-1] / 100. * (1. + config->household.third_tv[res-1] / 100.));
+    cost += k_cost_appliance * appliances;
+    if (number <= first + (int)(share * config->household.prevalence.boiler[res-1] / 100.0)) cost += k_cost_boiler;
+    cost += k_cost_lamp * config->household.prevalence.light[res-1] / 100.
+            * (config->household.min_area[res-1] + config->household.max_area[res-1]) / 2.
+            / config->household.light_factor[res-1];
+    if (!config->powerflow.step_size)
+    {
+        cost += k_cost_solar_module * p_solar;
+        cost += k_cost_battery * (p_solar * config->battery.frequency_solar
+                                  + (1.-p_solar) * config->battery.frequency_non_solar) / 100.;
+    }
+    if (config->simulate_heating) cost += k_cost_heating;
+    return cost;
+}
+
+
+#ifdef PARALLEL
+// Assign each process a contiguous range of households with about the same
+// expected costs (instead of the same number of households). The costs are
+// computed from the configuration alone, so every process can do this on
+// its own for all households.
+
+void Household::balance_load()
+{
+    int limit[k_max_residents], start[2];
+    double total = 0., sum = 0.;
+    int number = 1;
+
+    size_limits (limit);
+    for (int n=1; n<=global_count; n++) total += expected_cost (n, limit);
+
+    // A household belongs to the process in whose share of the total costs
+    // the middle of its own costs lies
+    for (int j=0; j<2; j++)
+    {
+        const double target = total * (rank+j) / num_processes;
+        if (rank+j == num_processes) number = global_count+1;
+        while (number <= global_count)
+        {
+            const double cost = expected_cost (number, limit);
+            if (sum + cost/2. >= target) break;
+            sum += cost;
+            number++;
+        }
+        start[j] = number;
+    }
+    first_number = start[0];
+    local_count = start[1] - start[0];
+}
+#endif
+
+
+// All households are constructed now, so the appliance arrays will not be
+// reallocated anymore and each household can point to its first appliance
+
+void Household::link_appliances()
 {
-    AirConditioner *next_ac, *ac = aircon;
-    Boiler *next_bo, *bo = boiler;
-    CirculationPump *next_cp, *cp = circpump;
-    Computer *next_co, *co = computer;
-    ElectricStove *next_es, *es = e_stove;
-    GasStove *next_gs, *gs = gas_stove;
-    Dishwasher *next_dw, *dw = dishwasher;
-    E_Vehicle *next_ev, *ev = e_vehicle;
-    Freezer *next_fz, *fz = freezer;
-    Fridge *next_fr, *fr = fridge;
-    Heating *next_ht, *ht = heating;
-    Light *next_lt, *lt = light;
-    TumbleDryer *next_td, *td = tumble_dryer;
-    TV *next_tel, *tel = tv;
-    Vacuum *next_vc, *vc = vacuum;
-    WashingMachine *next_wm, *wm = wmachine;
-    HeatPump *next_hp, *hp = heatpump;
+    AirConditioner::link (&Household::aircon);
+    Boiler::link (&Household::boiler);
+    CirculationPump::link (&Household::circpump);
+    Computer::link (&Household::computer);
+    ElectricStove::link (&Household::e_stove);
+    GasStove::link (&Household::gas_stove);
+    Dishwasher::link (&Household::dishwasher);
+    E_Vehicle::link (&Household::e_vehicle);
+    Freezer::link (&Household::freezer);
+    Fridge::link (&Household::fridge);
+    Heating::link (&Household::heating);
+    HeatPump::link (&Household::heatpump);
+    Light::link (&Household::light);
+    TumbleDryer::link (&Household::tumble_dryer);
+    TV::link (&Household::tv);
+    Vacuum::link (&Household::vacuum);
+    WashingMachine::link (&Household::wmachine);
+}
 
+
+Household::~Household()
+{
     if (solar_module) delete solar_module;
     if (battery) delete battery;
-    for (int i=0; i<num_aircons; i++) {next_ac = ac->next_app; delete ac; ac = next_ac;}
-    for (int i=0; i<num_boilers; i++) {next_bo = bo->next_app; delete bo; bo = next_bo;}
-    for (int i=0; i<num_circpumps; i++) {next_cp = cp->next_app; delete cp; cp = next_cp;}
-    for (int i=0; i<num_computers; i++) {next_co = co->next_app; delete co; co = next_co;}
-    for (int i=0; i<num_e_stoves; i++) {next_es = es->next_app; delete es; es = next_es;}
-    for (int i=0; i<num_gas_stoves; i++) {next_gs = gs->next_app; delete gs; gs = next_gs;}
-    for (int i=0; i<num_dishwashers; i++) {next_dw = dw->next_app; delete dw; dw = next_dw;}
-    for (int i=0; i<num_evehicles; i++) {next_ev = ev->next_app; delete ev; ev = next_ev;}
-    for (int i=0; i<num_freezers; i++) {next_fz = fz->next_app; delete fz; fz = next_fz;}
-    for (int i=0; i<num_fridges; i++) {next_fr = fr->next_app; delete fr; fr = next_fr;}
-    for (int i=0; i<num_heatings; i++) {next_ht = ht->next_app; delete ht; ht = next_ht;}
-    for (int i=0; i<num_heatpumps; i++) {next_hp = hp->next_app; delete hp; hp = next_hp;}
-    for (int i=0; i<num_lamps; i++) {next_lt = lt->next_app; delete lt; lt = next_lt;}
-    for (int i=0; i<num_dryers; i++) {next_td = td->next_app; delete td; td = next_td;}
-    for (int i=0; i<num_tvs; i++) {next_tel = tel->next_app; delete tel; tel = next_tel;}
-    for (int i=0; i<num_vacuums; i++) {next_vc = vc->next_app; delete vc; vc = next_vc;}
-    for (int i=0; i<num_wmachines; i++) {next_wm = wm->next_app; delete wm; wm = next_wm;}
-    if (config->simulate_heating)
-    {
-        delete [] a_matrix;
-        delete [] b_vector;
-        delete [] offsets;
-    }
     if (num_evehicles) delete [] distance;
+    delete [] dhw_timer;
+    delete [] dhw_schedule;
 }
 
 
 void Household::deallocate_memory()
 {
     delete [] hh;
+    delete [] vacation_list;
+    delete [] vacation_count;
+    ThreadTotals::deallocate_memory();
+    ThermalBatch::deallocate_memory();
+    AirConditioner::deallocate_memory();
+    Boiler::deallocate_memory();
+    CirculationPump::deallocate_memory();
+    Computer::deallocate_memory();
+    ElectricStove::deallocate_memory();
+    GasStove::deallocate_memory();
+    Dishwasher::deallocate_memory();
+    E_Vehicle::deallocate_memory();
+    Freezer::deallocate_memory();
+    Fridge::deallocate_memory();
+    Heating::deallocate_memory();
+    HeatPump::deallocate_memory();
+    Light::deallocate_memory();
+    TumbleDryer::deallocate_memory();
+    TV::deallocate_memory();
+    Vacuum::deallocate_memory();
+    WashingMachine::deallocate_memory();
 }
 
 
-template <class AP>
-void Household::add_appliance (AP **first)
+// A checkpoint contains the state of all households of this process. A restarted
+// simulation sets up the households in the same way (with the seed stored in the
+// checkpoint) and then overwrites their state. Each household is stored as it is,
+// followed by the memory it owns: the DHW schedule and timers, the building elements
+// and the solar module, solar collector, battery, heat source and heat storage.
+
+void Household::write_checkpoint (FILE *fp)
 {
-    AP *appliance;
-    try
-    {
-        appliance = new AP (this);
-    }
-    catch (...)
+    write_checkpoint_data (fp, &local_count, sizeof (local_count));
+    write_checkpoint_data (fp, &batteries_active, sizeof (batteries_active));
+    write_checkpoint_data (fp, with_solar_costs, sizeof (with_solar_costs));
+    write_checkpoint_data (fp, without_solar_costs, sizeof (without_solar_costs));
+    write_checkpoint_data (fp, income_total, sizeof (income_total));
+    write_checkpoint_data (fp, consumption_SH_total_integral, sizeof (consumption_SH_total_integral));
+    write_checkpoint_data (fp, consumption_DHW_total_integral, sizeof (consumption_DHW_total_integral));
+    write_checkpoint_data (fp, &power_to_grid_total_integral, sizeof (power_to_grid_total_integral));
+    write_checkpoint_data (fp, &power_above_limit_total_integral, sizeof (power_above_limit_total_integral));
+    ThermalBatch::store_temperatures();
+    for (int i=0; i<local_count; i++) hh[i].write_state (fp);
+    AirConditioner::write_checkpoint (fp);
+    Boiler::write_checkpoint (fp);
+    CirculationPump::write_checkpoint (fp);
+    Computer::write_checkpoint (fp);
+    ElectricStove::write_checkpoint (fp);
+    GasStove::write_checkpoint (fp);
+    Dishwasher::write_checkpoint (fp);
+    E_Vehicle::write_checkpoint (fp);
+    Freezer::write_checkpoint (fp);
+    Fridge::write_checkpoint (fp);
+    Heating::write_checkpoint (fp);
+    HeatPump::write_checkpoint (fp);
+    Light::write_checkpoint (fp);
+    TumbleDryer::write_checkpoint (fp);
+    TV::write_checkpoint (fp);
+    Vacuum::write_checkpoint (fp);
+    WashingMachine::write_checkpoint (fp);
+}
+
+
+void Household::read_checkpoint (FILE *fp)
+{
+    int num;
+
+    read_checkpoint_data (fp, &num, sizeof (num));
+    if (num != local_count)
     {
-        fprintf (stderr, "Unable to allocate memory for appliance.\n");
+        fprintf (stderr, "The households don't match the checkpoint.\n");
         exit (1);
     }
-    *first = appliance;
+    read_checkpoint_data (fp, &batteries_active, sizeof (batteries_active));
+    read_checkpoint_data (fp, with_solar_costs, sizeof (with_solar_costs));
+    read_checkpoint_data (fp, without_solar_costs, sizeof (without_solar_costs));
+    read_checkpoint_data (fp, income_total, sizeof (income_total));
+    read_checkpoint_data (fp, consumption_SH_total_integral, sizeof (consumption_SH_total_integral));
+    read_checkpoint_data (fp, consumption_DHW_total_integral, sizeof (consumption_DHW_total_integral));
+    read_checkpoint_data (fp, &power_to_grid_total_integral, sizeof (power_to_grid_total_integral));
+    read_checkpoint_data (fp, &power_above_limit_total_integral, sizeof (power_above_limit_total_integral));
+    for (int i=0; i<local_count; i++) hh[i].read_state (fp);
+    link_appliances();
+    ThermalBatch::deallocate_memory();  // set up again from the elements' temperatures
+    AirConditioner::read_checkpoint (fp);
+    Boiler::read_checkpoint (fp);
+    CirculationPump::read_checkpoint (fp);
+    Computer::read_checkpoint (fp);
+    ElectricStove::read_checkpoint (fp);
+    GasStove::read_checkpoint (fp);
+    Dishwasher::read_checkpoint (fp);
+    E_Vehicle::read_checkpoint (fp);
+    Freezer::read_checkpoint (fp);
+    Fridge::read_checkpoint (fp);
+    Heating::read_checkpoint (fp);
+    HeatPump::read_checkpoint (fp);
+    Light::read_checkpoint (fp);
+    TumbleDryer::read_checkpoint (fp);
+    TV::read_checkpoint (fp);
+    Vacuum::read_checkpoint (fp);
+    WashingMachine::read_checkpoint (fp);
 }
 
 
-void Household::add_tv (int rnk)
+void Household::write_state (FILE *fp)
 {
-    class TV *new_tv;
-    try
+    int table = (dhw_table == table_DHW_saturday) ? 1 : (dhw_table == table_DHW_sunday) ? 2 : 0;
+
+    write_checkpoint_data (fp, this, sizeof (Household));
+    write_checkpoint_data (fp, &table, sizeof (table));
+    write_checkpoint_data (fp, dhw_schedule, num_dhw_events*sizeof (DHW_event));
+    write_checkpoint_data (fp, dhw_timer, num_dhw_timers*sizeof (Timer));
+    for (int e=0; e<num_elements; e++) write_checkpoint_data (fp, elements[e], sizeof (Element));
+    if (solar_module) write_checkpoint_data (fp, solar_module, sizeof (SolarModule));
+    if (solar_collector) write_checkpoint_data (fp, solar_collector, sizeof (SolarCollector));
+    if (battery) write_checkpoint_data (fp, battery, sizeof (Battery));
+    if (heat_source) write_checkpoint_data (fp, heat_source, sizeof (HeatSource));
+    if (heat_storage) write_checkpoint_data (fp, heat_storage, sizeof (HeatStorage));
+}
+
+
+// Read one of the parts a household owns, e.g. its battery
+
+template <class T>
+void Household::read_part (FILE *fp, T *part, const T *image_part)
+{
+    if ((part == NULL) != (image_part == NULL))
     {
-        new_tv = new TV (this, rnk);
+        fprintf (stderr, "The households don't match the checkpoint.\n");
+        exit (1);
     }
-    catch (...)
+    if (part)
     {
-        fprintf (stderr, "Unable to allocate memory for a new TV.\n");
+        class Household *owner = part->household;
+        read_checkpoint_data (fp, part, sizeof (T));
+        part->household = owner;
+    }
+}
+
+
+// The pointers stored in the checkpoint are meaningless for this process, so
+// everything that points to memory is kept. The pointers to the appliances
+// are set by link_appliances() afterwards.
+
+void Household::read_state (FILE *fp)
+{
+    class SolarModule *sm = solar_module;
+    class SolarCollector *sc = solar_collector;
+    class Battery *bat = battery;
+    class HeatSource *hs = heat_source;
+    class HeatStorage *hst = heat_storage;
+    Element **el = elements;
+    double *dist = distance;
+    DHW_event *schedule = dhw_schedule;
+    Timer *timer = dhw_timer;
+    int max_events = max_dhw_events;
+    int max_timers = max_dhw_timers;
+    int num = number;
+    int num_el = num_elements;
+    int table;
+
+    read_checkpoint_data (fp, this, sizeof (Household));
+    if (number != num || num_elements != num_el)
+    {
+        fprintf (stderr, "The households don't match the checkpoint.\n");
         exit (1);
     }
-    tv = new_tv;
+    read_checkpoint_data (fp, &table, sizeof (table));
+    dhw_table = (table == 1) ? table_DHW_saturday : (table == 2) ? table_DHW_sunday : table_DHW_weekday;
+    if (max_dhw_events > max_events)
+    {
+        delete [] schedule;
+        alloc_memory (&schedule, max_dhw_events, "Household::read_state");
+    }
+    else max_dhw_events = max_events;
+    dhw_schedule = schedule;
+    read_checkpoint_data (fp, dhw_schedule, num_dhw_events*sizeof (DHW_event));
+    if (max_dhw_timers > max_timers)
+    {
+        delete [] timer;
+        alloc_memory (&timer, max_dhw_timers, "Household::read_state");
+    }
+    else max_dhw_timers = max_timers;
+    dhw_timer = timer;
+    read_checkpoint_data (fp, dhw_timer, num_dhw_timers*sizeof (Timer));
+    elements = el;
+    for (int e=0; e<num_elements; e++) read_checkpoint_data (fp, elements[e], sizeof (Element));
+    distance = dist;
+    read_part (fp, sm, solar_module);
+    solar_module = sm;
+    read_part (fp, sc, solar_collector);
+    solar_collector = sc;
+    read_part (fp, bat, battery);
+    battery = bat;
+    read_part (fp, hs, heat_source);
+    heat_source = hs;
+    read_part (fp, hst, heat_storage);
+    heat_storage = hst;
+}
+
+
+// The appliances are stored in one array per appliance type (see Appliance_CRTP::new_slot)
+
+template <class AP>
+void Household::add_appliance (AP **first)
+{
+    *first = new (AP::new_slot()) AP (this);
+}
+
+
+void Household::add_tv (int rnk)
+{
+    tv = new (TV::new_slot()) TV (this, rnk);
 }
 
 
@@ -670,11 +955,15 @@ void Household::add_heat_source()
     }
 }
 
+// The profile at_home ends with the row for k_seconds_per_day, which stands
+// for the rest of the day. Times after midnight must not run past it, the
+// rows behind it are left over from previous days or not written at all.
+
 double Household::residents_at_home_duration (double start_time, int num)
 {
     int i = 0, first_i;
 
-    while (start_time > at_home[i][0]) i++;
+    while (start_time > at_home[i][0] && at_home[i][0] < k_seconds_per_day) i++;
     first_i = i;
     while (at_home[i][0] < k_seconds_per_day && at_home[i][1] >= num) i++;
 
@@ -686,7 +975,7 @@ double Household::residents_at_home_duration (double start_time, int num)
 int Household::residents_at_home (double daytime)
 {
     int i = 0;
-    while (daytime > at_home[i][0]) i++;
+    while (daytime > at_home[i][0] && at_home[i][0] < k_seconds_per_day) i++;
     return at_home[i][1];
 }
 
@@ -704,7 +993,7 @@ void Household::get_interval (double *begin, double *end, double limit_1, int rn
 {
     int i = 0;
     *begin = limit_1;
-    while (limit_1 > at_home[i][0])
+    while (limit_1 > at_home[i][0] && at_home[i][0] < k_seconds_per_day)
     {
         *begin = at_home[i][0];
         i++;
@@ -734,48 +1023,173 @@ double Household::get_random_start_time (double begin, double end)
 }
 
 
+// The households of a process are distributed among a team of threads.
+// Each pass must be completed by all households before the next one starts,
+// which is guaranteed by the implicit barrier at the end of each 'omp for'.
+// Then the threads' partial totals are combined (see ThreadTotals).
+// The producer talks to the other processes via MPI, so only the master
+// thread calls it while the other threads wait at the barrier.
+
+// The thermal models of the households are solved in batches (see ThermalBatch).
+// Whenever this is due, the 1st pass is split in two: the set temperatures of all
+// households are updated first, then the thermal models are solved and then the
+// rest of the 1st pass uses the resulting heating and cooling demand.
+
+// Called by every thread at the beginning of a parallel region: the totals
+// the households add to during a pass (all threads in the same order)
+
+void Household::register_totals()
+{
+#ifdef _OPENMP
+    if (omp_get_num_threads() == 1) return;
+    ThreadTotals::begin();
+    ThreadTotals::add (AirConditioner::power_total, k_max_residents+1);
+    ThreadTotals::add (Boiler::power_total, k_max_residents+1);
+    ThreadTotals::add (CirculationPump::power_total, k_max_residents+1);
+    ThreadTotals::add (Computer::power_total, k_max_residents+1);
+    ThreadTotals::add (ElectricStove::power_total, k_max_residents+1);
+    ThreadTotals::add (GasStove::power_total, k_max_residents+1);
+    ThreadTotals::add (Dishwasher::power_total, k_max_residents+1);
+    ThreadTotals::add (E_Vehicle::power_total, k_max_residents+1);
+    ThreadTotals::add (Freezer::power_total, k_max_residents+1);
+    ThreadTotals::add (Fridge::power_total, k_max_residents+1);
+    ThreadTotals::add (Heating::power_total, k_max_residents+1);
+    ThreadTotals::add (HeatPump::power_total, k_max_residents+1);
+    ThreadTotals::add (Light::power_total, k_max_residents+1);
+    ThreadTotals::add (TumbleDryer::power_total, k_max_residents+1);
+    ThreadTotals::add (TV::power_total, k_max_residents+1);
+    ThreadTotals::add (Vacuum::power_total, k_max_residents+1);
+    ThreadTotals::add (WashingMachine::power_total, k_max_residents+1);
+    ThreadTotals::add (with_solar_costs, k_max_residents+1);
+    ThreadTotals::add (without_solar_costs, k_max_residents+1);
+    ThreadTotals::add (income_total, k_max_residents+1);
+    ThreadTotals::add (consumption_SH_total_integral, NUM_HEAT_SOURCE_TYPES);
+    ThreadTotals::add (consumption_DHW_total_integral, NUM_HEAT_SOURCE_TYPES);
+    ThreadTotals::add (real_power_total, k_max_residents+1);
+    ThreadTotals::add (reactive_power_total, k_max_residents+1);
+    ThreadTotals::add (power_hot_water, k_max_residents+1);
+    ThreadTotals::add (&power_from_grid_total, 1);
+    ThreadTotals::add (&power_to_grid_total, 1);
+    ThreadTotals::add (&power_to_grid_total_integral, 1);
+    ThreadTotals::add (&production_used_total, 1);
+    ThreadTotals::add (&power_above_limit_total, 1);
+    ThreadTotals::add (&power_above_limit_total_integral, 1);
+    ThreadTotals::add (&Battery::charge_total, 1);
+    ThreadTotals::add (&Battery::power_charging_total, 1);
+    ThreadTotals::add (&Battery::power_discharging_total, 1);
+    ThreadTotals::add (&Battery::power_from_grid_total, 1);
+    ThreadTotals::add (&Battery::power_from_grid_total_integral, 1);
+    ThreadTotals::add (&Battery::loss_charging_total, 1);
+    ThreadTotals::add (&Battery::loss_discharging_total, 1);
+    ThreadTotals::add (&HeatSource::heat_power_SH_total[0][0], NUM_HEAT_SOURCE_TYPES*(k_max_residents+1));
+    ThreadTotals::add (&HeatSource::heat_power_DHW_total[0][0], NUM_HEAT_SOURCE_TYPES*(k_max_residents+1));
+    ThreadTotals::add (HeatStorage::power_total, k_max_residents+1);
+    ThreadTotals::add (&HeatStorage::stored_heat_total, 1);
+    ThreadTotals::add (SolarCollector::power_total, k_max_residents+1);
+    ThreadTotals::add (&SolarCollector::power_total_integral, 1);
+    ThreadTotals::add (SolarModule::real_power_total, k_max_residents+1);
+    ThreadTotals::add (SolarModule::reactive_power_total, k_max_residents+1);
+    ThreadTotals::add (&SolarModule::power_total_integral, 1);
+#endif
+}
+
+void Household::run_1st_pass (double time)
+{
+    if (config->simulate_heating && (int)sim_clock->daytime % 3600 == 0)  // every hour
+    {
+#pragma omp for schedule(static)
+        for (int i=0; i<local_count; i++) hh[i].begin_1st_pass();
+        ThermalBatch::simulate();
+#pragma omp for schedule(static)
+        for (int i=0; i<local_count; i++) hh[i].simulate_1st_pass (time);
+    }
+    else
+    {
+#pragma omp for schedule(static)
+        for (int i=0; i<local_count; i++)
+        {
+            hh[i].begin_1st_pass();
+            hh[i].simulate_1st_pass (time);
+        }
+    }
+}
+
 void Household::simulate_forerun()
 {
     double time = sim_clock->cur_time;
-    for (int i=0; i<local_count; i++) hh[i].simulate_1st_pass (time);
-    if (config->control == PEAK_SHAVING) producer->update_maximum_peak();
-    real_power_total[0] = 0.;
-    reactive_power_total[0] = 0.;
-    apparent_power_total[0] = 0.;
-    power_hot_water[0] = 0.;
-    for (int i=0; i<local_count; i++) hh[i].simulate_2nd_pass (time, false);
-    for (int i=0; i<local_count; i++) hh[i].simulate_3rd_pass (time, false);
+#pragma omp parallel
+    {
+        register_totals();
+        Profiler::start (PROFILE_PRERUN_1ST_PASS);
+        run_1st_pass (time);
+        ThreadTotals::combine();
+        Profiler::stop (PROFILE_PRERUN_1ST_PASS);
+#pragma omp master
+        {
+            // The scenarios may use peak shaving, even if the base configuration doesn't
+            if (config->control == PEAK_SHAVING || config->scenarios.count) producer->update_maximum_peak();
+            real_power_total[0] = 0.;
+            reactive_power_total[0] = 0.;
+            power_hot_water[0] = 0.;
+        }
+#pragma omp barrier
+        Profiler::start (PROFILE_PRERUN_2ND_PASS);
+#pragma omp for schedule(static)
+        for (int i=0; i<local_count; i++) hh[i].simulate_2nd_pass (time, false);
+        ThreadTotals::combine();
+        Profiler::stop (PROFILE_PRERUN_2ND_PASS);
+        Profiler::start (PROFILE_PRERUN_3RD_PASS);
+#pragma omp for schedule(static)
+        for (int i=0; i<local_count; i++) hh[i].simulate_3rd_pass (time, false);
+        ThreadTotals::combine();
+        Profiler::stop (PROFILE_PRERUN_3RD_PASS);
+    }
 }
 
 void Household::simulate()
 {
     double time = sim_clock->cur_time;
-    for (int i=0; i<local_count; i++) hh[i].simulate_1st_pass (time);
-    producer->simulate (time);
-    for (int i=0; i<local_count; i++) hh[i].simulate_2nd_pass (time, true);
-    for (int i=0; i<local_count; i++) hh[i].simulate_3rd_pass (time, true);
+#pragma omp parallel
+    {
+        register_totals();
+        Profiler::start (PROFILE_1ST_PASS);
+        run_1st_pass (time);
+        ThreadTotals::combine();
+        Profiler::stop (PROFILE_1ST_PASS);
+#pragma omp master
+        producer->simulate (time);
+#pragma omp barrier
+        Profiler::start (PROFILE_2ND_PASS);
+#pragma omp for schedule(static)
+        for (int i=0; i<local_count; i++) hh[i].simulate_2nd_pass (time, true);
+        ThreadTotals::combine();
+        Profiler::stop (PROFILE_2ND_PASS);
+        Profiler::start (PROFILE_3RD_PASS);
+        if (config->battery_charging.shared)
+        {
+            // Shared battery charging gives a household access to the batteries
+            // of its neighbours, so the 3rd pass must not be split among threads.
+            // It is always the master thread, so that the totals are summed up
+            // in the same order in every run.
+#pragma omp master
+            for (int i=0; i<local_count; i++) hh[i].simulate_3rd_pass (time, true);
+#pragma omp barrier
+        }
+        else
+        {
+#pragma omp for schedule(static)
+            for (int i=0; i<local_count; i++) hh[i].simulate_3rd_pass (time, true);
+        }
+        ThreadTotals::combine();
+        Profiler::stop (PROFILE_3RD_PASS);
+    }
 }
 
-void Household::simulate_1st_pass (double time)
+void Household::begin_1st_pass()
 {
     int limit;
-    AirConditioner *ac = aircon;
-    Boiler *bo = boiler;
-    CirculationPump *cp = circpump;
-    Computer *co = computer;
-    ElectricStove *es = e_stove;
-    GasStove *gs = gas_stove;
-    Dishwasher *dw = dishwasher;
-    E_Vehicle *ev = e_vehicle;
-    Freezer *fz = freezer;
-    Fridge *fr = fridge;
-    Heating *ht = heating;
-    Light *lt = light;
-    TumbleDryer *td = tumble_dryer;
-    TV *tel = tv;
-    Vacuum *vc = vacuum;
-    WashingMachine *wm = wmachine;
-    HeatPump *hp = heatpump;
+
+    select_random_stream (&rng);
 
     if (sim_clock->midnight)
     {
@@ -869,12 +1283,16 @@ void Household::simulate_1st_pass (double time)
         }
         shopping_done = false;
     }
-    // Calculate the amount of energy needed for space heating and cooling according to ISO 52016-1
+    // The amount of energy needed for space heating and cooling according to ISO 52016-1
+    // is calculated every hour by ThermalBatch::simulate, once this is done for all households
 
-    if (config->simulate_heating && (int)sim_clock->daytime % 3600 == 0)  // every hour
-    {
-        space_heating_and_cooling_demand();
-    }
+    if (config->simulate_heating && (int)sim_clock->daytime % 3600 == 0) set_temperatures();
+}
+
+
+void Household::simulate_1st_pass (double time)
+{
+    select_random_stream (&rng);
 
     // Calculate the amount of heat for domestic hot water (dhw)
 
@@ -882,27 +1300,20 @@ void Household::simulate_1st_pass (double time)
     {
         if (sim_clock->midnight)  // Schedule hygiene activities at the beginning of each day
         {
-            // Init the probability array depending on sleep times and erase the schedule
-            probability_sum = 0.;
-            double *table;
+            // Select the probability table, sum it up over the minutes in which
+            // the residents are awake and erase the schedule
             switch (sim_clock->weekday)
             {
-                case SATURDAY: table = table_DHW_saturday; break;
-                case SUNDAY:   table = table_DHW_sunday; break;
-                default:       table = table_DHW_weekday; break;
-            }
-            if (sim_clock->holiday) table = table_DHW_sunday;
-            for (int i=0; i<1440; i++)
-            {
-                if (i*60. < bedtime_old || (i*60. >= wakeup && i*60. < bedtime))
-                {
-                    probability[i] = probability_sum + table[i];
-                    probability_sum += table[i];
-                }
-                else probability[i] = -1.;
-                dhw_schedule[i] = DO_NOTHING;
+                case SATURDAY: dhw_table = table_DHW_saturday; break;
+                case SUNDAY:   dhw_table = table_DHW_sunday; break;
+                default:       dhw_table = table_DHW_weekday; break;
             }
+            if (sim_clock->holiday) dhw_table = table_DHW_sunday;
+            probability_sum = 0.;
+            for (int i=0; i<1440; i++) if (awake (i)) probability_sum += dhw_table[i];
+            num_dhw_events = 0;
             dhw_schedule_pos = 0;
+            dhw_event_pos = 0;
 
             // Wash your hands
             int num_handw = 0;
@@ -923,6 +1334,11 @@ void Household::simulate_1st_pass (double time)
 
         while (dhw_schedule_pos*60 <= sim_clock->daytime)
         {
+            if (dhw_event_pos == num_dhw_events || dhw_schedule[dhw_event_pos].minute != dhw_schedule_pos)
+            {
+                dhw_schedule_pos++;  // nothing to do in this minute
+                continue;
+            }
             double mass_flow;
             double volume;
             double duration;
@@ -930,7 +1346,7 @@ void Household::simulate_1st_pass (double time)
             double heat_demand;
             double min_temp = config->household.min_temperature_DHW;
             double max_temp = config->household.max_temperature_DHW;
-            switch (dhw_schedule[dhw_schedule_pos])
+            switch (dhw_schedule[dhw_event_pos].activity)
             {
                 case HANDWASH:
                     mass_flow = get_random_number (3.,8.)/60.;                              // liter per second
@@ -964,13 +1380,14 @@ void Household::simulate_1st_pass (double time)
                 default:
                     break;
             }
+            dhw_event_pos++;
             dhw_schedule_pos++;
         }
-        Timer *t = first_timer;
-        Timer *prev = NULL;
         double sum_heat = 0.;
-        while (t)
+        int num = 0;
+        for (int i=num_dhw_timers-1; i>=0; i--)  // the latest activity first
         {
+            Timer *t = dhw_timer+i;
             if (t->duration < config->timestep_size)
             {
                 sum_heat += t->heat_demand * t->duration/config->timestep_size;
@@ -978,20 +1395,13 @@ void Household::simulate_1st_pass (double time)
             else sum_heat += t->heat_demand;
 
             t->duration -= config->timestep_size;
-            if (t->duration <= 0.) // time's up. delete the timer
-            {
-                if (t==first_timer) first_timer = t->next;
-                else prev->next = t->next;
-                Timer *del = t;
-                t = t->next;
-                delete del;
-            }
-            else
-            {
-                prev = t;
-                t = t->next;
-            }
         }
+        // time's up for some timers. Remove them, keeping the order of the others
+        for (int i=0; i<num_dhw_timers; i++)
+        {
+            if (dhw_timer[i].duration > 0.) dhw_timer[num++] = dhw_timer[i];
+        }
+        num_dhw_timers = num;
         heat_demand_DHW = location->seasonal_factor * (heat_loss_DHW + sum_heat);
     }
     else heat_demand_DHW = 0.;  // household is on vacation
@@ -1006,22 +1416,23 @@ void Household::simulate_1st_pass (double time)
     heat_loss_app = 0.;
     if (vacation <= 0)  // if not on vacation
     {
-        for (int i=0; i<num_aircons; i++) {ac->simulate(); ac=ac->next_app;}
-        for (int i=0; i<num_circpumps; i++) {cp->simulate(); cp=cp->next_app;}
-        for (int i=0; i<num_computers; i++) {co->simulate(); co=co->next_app;}
-        for (int i=0; i<num_e_stoves; i++) {es->simulate(); es=es->next_app;}
-        for (int i=0; i<num_gas_stoves; i++) {gs->simulate(); gs=gs->next_app;}
-        for (int i=0; i<num_dishwashers; i++) {dw->simulate (time); dw=dw->next_app;}
-        for (int i=0; i<num_evehicles; i++) { ev->simulate(); ev = ev->next_app; }
-        for (int i=0; i<num_fridges; i++) {fr->simulate (time); fr=fr->next_app;}
-        for (int i=0; i<num_lamps; i++) {lt->simulate(); lt=lt->next_app;}
-        for (int i=0; i<num_dryers; i++) {td->simulate (time); td=td->next_app;}
-        for (int i=0; i<num_tvs; i++) {tel->simulate(); tel=tel->next_app;}
-        for (int i=0; i<num_vacuums; i++) {vc->simulate(); vc=vc->next_app;}
-        for (int i=0; i<num_wmachines; i++) {wm->simulate (time); wm=wm->next_app;}
-        for (int i=0; i<num_boilers; i++) {bo->simulate(); bo=bo->next_app;}
-    }
-    for (int i=0; i<num_freezers; i++) {fz->simulate (time); fz=fz->next_app;}
+        steps_at_home++;
+        for (int i=0; i<num_aircons; i++) aircon[i].simulate();
+        for (int i=0; i<num_circpumps; i++) circpump[i].simulate();
+        for (int i=0; i<num_computers; i++) if (computer[i].due()) computer[i].simulate();
+        for (int i=0; i<num_e_stoves; i++) if (e_stove[i].due()) e_stove[i].simulate();
+        for (int i=0; i<num_gas_stoves; i++) if (gas_stove[i].due()) gas_stove[i].simulate();
+        for (int i=0; i<num_dishwashers; i++) if (dishwasher[i].due()) dishwasher[i].simulate (time);
+        for (int i=0; i<num_evehicles; i++) e_vehicle[i].simulate();
+        for (int i=0; i<num_fridges; i++) fridge[i].simulate (time);
+        for (int i=0; i<num_lamps; i++) if (light[i].due()) light[i].simulate();
+        for (int i=0; i<num_dryers; i++) if (tumble_dryer[i].due()) tumble_dryer[i].simulate (time);
+        for (int i=0; i<num_tvs; i++) if (tv[i].due()) tv[i].simulate();
+        for (int i=0; i<num_vacuums; i++) if (vacuum[i].due()) vacuum[i].simulate();
+        for (int i=0; i<num_wmachines; i++) if (wmachine[i].due()) wmachine[i].simulate (time);
+        for (int i=0; i<num_boilers; i++) boiler[i].simulate();
+    }
+    for (int i=0; i<num_freezers; i++) freezer[i].simulate (time);
 
     // Simulate heat sources
     switch (heat_source_type)
@@ -1032,17 +1443,18 @@ void Household::simulate_1st_pass (double time)
             heat_source->simulate();
             break;
         case HEAT_PUMP:
-            for (int i=0; i<num_heatpumps; i++) {hp->simulate(); hp=hp->next_app;}
+            for (int i=0; i<num_heatpumps; i++) heatpump[i].simulate();
             // auxiliary electrical heating:
-            for (int i=0; i<num_heatings; i++) {ht->simulate (); ht=ht->next_app;}
+            for (int i=0; i<num_heatings; i++) heating[i].simulate();
             break;
         case SOLAR_COLLECTOR:
             solar_collector->simulate();
-            for (int i=0; i<num_heatpumps; i++) {hp->simulate(); hp=hp->next_app;}
+            for (int i=0; i<num_heatpumps; i++) heatpump[i].simulate();
             heat_storage->simulate();
             break;
         default:;
     }
+    select_random_stream (NULL);
 }
 
 
@@ -1052,6 +1464,8 @@ void Household::simulate_2nd_pass (double time, bool main_simulation)
     double daytime = sim_clock->daytime;
     double delta, power_solar, power_discharging;
 
+    select_random_stream (&rng);
+
     if (almost_equal (daytime, sim_clock->sunrise) && main_simulation && solar_module && battery)
     {
         double production_forecast = 0.;
@@ -1102,6 +1516,7 @@ void Household::simulate_2nd_pass (double time, bool main_simulation)
         power_from_grid_total += delta;
     }
     else power_from_grid = 0.;
+    select_random_stream (NULL);
 }
 
 
@@ -1112,6 +1527,8 @@ void Household::simulate_3rd_pass (double time, bool main_simulation)
     double delta, above, costs, inc = 0.;
     double power_solar, power_charging;
 
+    select_random_stream (&rng);
+
     if (solar_module) power_solar = solar_module->power.real; else power_solar = 0.;
     if (battery && batteries_active) power_charging = battery->power_charging; else power_charging = 0.;
 
@@ -1120,7 +1537,9 @@ void Household::simulate_3rd_pass (double time, bool main_simulation)
 
     delta = power_solar - (power.real + power_charging);
 
-    if (delta > 0.)
+    // Without a solar module, delta can only be positive by rounding,
+    // when the producer switched off appliances of this household
+    if (delta > 0. && solar_module)
     {
         // 'above' is the part of 'delta' which is above the feed in limit
         // When using shared batteries, we try to store 'above' in another household's battery
@@ -1267,6 +1686,7 @@ void Household::simulate_3rd_pass (double time, bool main_simulation)
             last_update_mpfg = time;
         }
     }
+    select_random_stream (NULL);
 }
 
 
@@ -1396,55 +1816,21 @@ double Household::std_deviation (int res)
 }
 
 
-double Household::median (int res)
+void Household::median (double median[])
 {
-    double *values = NULL;
-    double median = 0;
-    int j;
-#ifdef PARALLEL
-    int num;
-    MPI_Status status;
-#endif
+    double *values;
+    int *group;
 
-    if (count[res])
+    alloc_memory (&values, local_count > 0 ? local_count : 1, "Household::median");
+    alloc_memory (&group, local_count > 0 ? local_count : 1, "Household::median");
+    for (int i=0; i<local_count; i++)
     {
-        alloc_memory (&values, count[res], "Household::median");
-        j = 0;
-        for (int i=0; i<local_count; i++)
-        {
-            if (hh[i].residents == res || res == 0)
-            {
-                values[j] = hh[i].consumption;
-                j++;
-            }
-        }
-#ifdef PARALLEL
-        if (rank == 0)
-        {
-            for (int i=1; i<num_processes; i++)
-            {
-                MPI_Recv (&num, 1, MPI_INT, i, 0, MPI_COMM_WORLD, &status);
-                MPI_Recv (values+j, num, MPI_DOUBLE, i, 0, MPI_COMM_WORLD, &status);
-                j += num;
-            }
-        }
-        else
-        {
-            MPI_Send (&j, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-            MPI_Send (values, j, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-        }
-        MPI_Barrier (MPI_COMM_WORLD);
-#endif
-        if (rank == 0)
-        {
-            qsort (values, (size_t)count[res], sizeof(double), (int (*)(const void *, const void *))&compare_double);
-            if (count[res]%2 == 1) median = values[count[res]/2];
-            else median = (values[count[res]/2] + values[count[res]/2-1]) / 2.;
-        }
-        delete [] values;
-        return median;
+        values[i] = hh[i].consumption;
+        group[i] = hh[i].residents;
     }
-    else return 0.;
+    calc_medians (values, group, local_count, count, consumption_min, consumption_max, median);
+    delete [] values;
+    delete [] group;
 }
 
 
@@ -1938,48 +2324,19 @@ void Household::smartification()
     // Now the smartification is done after all solarmodules have been
     // initialized.
 
-    class Dishwasher *dw;
-    class WashingMachine *wm;
-    class E_Vehicle *ev;
-    class Fridge *fr;
-    class Freezer *fz;
-
     for (int i=0; i<local_count; i++)
     {
         if (hh[i].solar_module)
         {
-            dw = hh[i].dishwasher;
-            for (int j=0; j<hh[i].num_dishwashers; j++)
-            {
-                dw->make_smart();
-                dw = dw->next_app;
-            }
-            wm = hh[i].wmachine;
-            for (int j=0; j<hh[i].num_wmachines; j++)
-            {
-                wm->make_smart();
-                wm = wm->next_app;
-            }
-            ev = hh[i].e_vehicle;
-            for (int j=0; j<hh[i].num_evehicles; j++)
-            {
-                ev->make_smart();
-                ev = ev->next_app;
-            }
-            fr = hh[i].fridge;
-            for (int j=0; j<hh[i].num_fridges; j++)
-            {
-                fr->make_smart();
-                fr = fr->next_app;
-            }
-            fz = hh[i].freezer;
-            for (int j=0; j<hh[i].num_freezers; j++)
-            {
-                fz->make_smart();
-                fz = fz->next_app;
-            }
+            select_random_stream (&hh[i].rng);
+            for (int j=0; j<hh[i].num_dishwashers; j++) hh[i].dishwasher[j].make_smart();
+            for (int j=0; j<hh[i].num_wmachines; j++) hh[i].wmachine[j].make_smart();
+            for (int j=0; j<hh[i].num_evehicles; j++) hh[i].e_vehicle[j].make_smart();
+            for (int j=0; j<hh[i].num_fridges; j++) hh[i].fridge[j].make_smart();
+            for (int j=0; j<hh[i].num_freezers; j++) hh[i].freezer[j].make_smart();
         }
     }
+    select_random_stream (NULL);
 }
 
 void Household::schedule (DHW_activity activity, int start_time)
@@ -1992,20 +2349,63 @@ void Household::schedule (DHW_activity activity, int start_time)
     if (start_time < 0)  // select a random time of start by using a probability distribution
     {
         double rnd = get_random_number (0., probability_sum);
-        start_time = 0;
-        while (rnd > probability[start_time]) start_time++;
+        double sum = 0.;
+        for (start_time=0; start_time<1439; start_time++)
+        {
+            if (awake (start_time))
+            {
+                sum += dhw_table[start_time];
+                if (rnd <= sum) break;
+            }
+        }
+    }
+    // avoid 2 activities starting at the same time
+    int i = 0;
+    while (i < num_dhw_events && dhw_schedule[i].minute < start_time) i++;
+    while (i < num_dhw_events && dhw_schedule[i].minute == start_time && start_time < 1439)
+    {
+        i++;
+        start_time++;
+    }
+    if (i < num_dhw_events && dhw_schedule[i].minute == start_time)
+    {
+        dhw_schedule[i].activity = activity;  // the last minute of the day is taken
+        return;
     }
-    while (dhw_schedule[start_time] != DO_NOTHING && start_time < 1439) start_time++; // avoid 2 activities starting at the same time
-    dhw_schedule[start_time] = activity;
+    if (num_dhw_events == max_dhw_events)
+    {
+        DHW_event *new_schedule;
+        max_dhw_events = max_dhw_events ? 2*max_dhw_events : 16;
+        alloc_memory (&new_schedule, max_dhw_events, "Household::schedule");
+        for (int j=0; j<num_dhw_events; j++) new_schedule[j] = dhw_schedule[j];
+        delete [] dhw_schedule;
+        dhw_schedule = new_schedule;
+    }
+    for (int j=num_dhw_events; j>i; j--) dhw_schedule[j] = dhw_schedule[j-1];
+    dhw_schedule[i].minute = start_time;
+    dhw_schedule[i].activity = activity;
+    num_dhw_events++;
+    // an activity scheduled for a minute that has passed already is never carried out
+    if (start_time < dhw_schedule_pos) dhw_event_pos++;
 }
 
+// The timers of a household are kept in an array, which is only replaced by a
+// larger one when necessary. So after the first days no more memory is allocated.
+
 void Household::add_timer (double duration, double heat_demand)
 {
-    Timer *t = new Timer;
-    t->duration = duration;
-    t->heat_demand = heat_demand;
-    t->next = first_timer;
-    first_timer = t;
+    if (num_dhw_timers == max_dhw_timers)
+    {
+        Timer *new_timer;
+        max_dhw_timers = max_dhw_timers ? 2*max_dhw_timers : 8;
+        alloc_memory (&new_timer, max_dhw_timers, "Household::add_timer");
+        for (int i=0; i<num_dhw_timers; i++) new_timer[i] = dhw_timer[i];
+        delete [] dhw_timer;
+        dhw_timer = new_timer;
+    }
+    dhw_timer[num_dhw_timers].duration = duration;
+    dhw_timer[num_dhw_timers].heat_demand = heat_demand;
+    num_dhw_timers++;
 }
 
 void Household::increase_power (double real, double reactive)
@@ -2017,9 +2417,6 @@ void Household::increase_power (double real, double reactive)
     power.reactive += reactive;
     reactive_power_total[0] += reactive;
     reactive_power_total[residents] += reactive;
-
-    apparent_power_total[0] = sqrt (real_power_total[0]*real_power_total[0] + reactive_power_total[0]*reactive_power_total[0]);
-    apparent_power_total[residents] = sqrt (real_power_total[residents]*real_power_total[residents] + reactive_power_total[residents]*reactive_power_total[residents]);
 }
 
 void Household::decrease_power (double real, double reactive)
@@ -2031,9 +2428,6 @@ void Household::decrease_power (double real, double reactive)
     power.reactive -= reactive;
     reactive_power_total[0] -= reactive;
     reactive_power_total[residents] -= reactive;
-
-    apparent_power_total[0] = real_power_total[0]*real_power_total[0] + reactive_power_total[0]*reactive_power_total[0];
-    apparent_power_total[residents] = real_power_total[residents]*real_power_total[residents] + reactive_power_total[residents]*reactive_power_total[residents];
 }
 
 void Household::construct_building (void)
@@ -2069,161 +2463,20 @@ void Household::construct_building (void)
     }
     num_elements = index;
     num_nodes = 0;
-    for (int i=0; i<num_elements; i++) num_nodes += elements[i]->num_nodes;
-}
-
-
-double Household::operative_temperature (double phi_HC)
-{
-    const char function_name[] = "operative_temperature";
-    const double kappa_int = 10000.;          // ISO 52016-1 table B.12
-    const double f_int_c = 0.4;               // ISO 52016-1 table B.11
-    const double f_sol_c = 0.4;               // ISO 52016-1 table B.11
-    const double f_HC_c = 0.4;                // ISO 52016-1 table B.11
-    const double delta_t = 3600.;             // timestep size in seconds
-    const double C_int = area * kappa_int;
-    double sum_area_hci, value;
-    double phi_int, phi_int_residents, phi_int_app, phi_sol;
-    int index;
-    int n = num_nodes+1;    // number of linear equations
-
-    // Initialize matrix A
-    // Since A does not change, this has to be done only once
-    if (a_matrix == NULL)
-    {
-        // Memory allocation
-        alloc_memory (&a_matrix, n*n, function_name);
-        for (int i=0; i<n*n; i++) a_matrix[i] = 0.;
-        alloc_memory (&b_vector, n, function_name);
-        alloc_memory (&offsets, num_elements, function_name);
-
-        // ISO 52016-1 equation (17)
-        sum_area_hci = 0.;
-        index = 1;
-        for (int i=0; i<num_elements; i++)
-        {
-            offsets[i] = index;
-            sum_area_hci += elements[i]->area * elements[i]->h_ci;
-            area_tot += elements[i]->area;
-            a_matrix[index] = -elements[i]->area * elements[i]->h_ci;
-            index += elements[i]->num_nodes;
-        }
-        a_matrix[0] = C_int/delta_t + sum_area_hci;
-        if (config->ventilation_model) a_matrix[0] += heat_transfer_ventilation();
-
-        index = n;
-        for (int i=0; i<num_elements; i++)
-        {
-            // ISO 52016-1 equation (19)   inner surface node
-            a_matrix[index+offsets[i]+1] = -elements[i]->h[0];
-            a_matrix[index+offsets[i]] = elements[i]->h_ci + elements[i]->h_ri + elements[i]->h[0];
-            a_matrix[index] = -elements[i]->h_ci;
-            for (int k=0; k<num_elements; k++)
-            {
-                a_matrix[index+offsets[k]] -= elements[k]->area*elements[i]->h_ri/area_tot;
-            }
-            index += n;
-            // ISO 52016-1 equation (20)   inner nodes
-            if (elements[i]->num_nodes == 5)
-            {
-                a_matrix[index+offsets[i]+2] = -elements[i]->h[1];
-                a_matrix[index+offsets[i]+1] = elements[i]->kappa[0]/delta_t + elements[i]->h[0] + elements[i]->h[1];
-                a_matrix[index+offsets[i]]   = -elements[i]->h[0];
-                index += n;
-                a_matrix[index+offsets[i]+3] = -elements[i]->h[2];
-                a_matrix[index+offsets[i]+2] = elements[i]->kappa[1]/delta_t + elements[i]->h[1] + elements[i]->h[2];
-                a_matrix[index+offsets[i]+1] = -elements[i]->h[1];
-                index += n;
-                a_matrix[index+offsets[i]+4] = -elements[i]->h[3];
-                a_matrix[index+offsets[i]+3] = elements[i]->kappa[2]/delta_t + elements[i]->h[2] + elements[i]->h[3];
-                a_matrix[index+offsets[i]+2] = -elements[i]->h[2];
-                index += n;
-            }
-            // ISO 52016-1 equation (21)   outer surface node
-            if (elements[i]->num_nodes == 5)
-            {
-                a_matrix[index+offsets[i]+4] = elements[i]->h_ce + elements[i]->h_re + elements[i]->h[3];
-                a_matrix[index+offsets[i]+3] = -elements[i]->h[3];
-            }
-            else
-            {
-                a_matrix[index+offsets[i]+1] = elements[i]->h_ce + elements[i]->h_re + elements[i]->h[0];
-                a_matrix[index+offsets[i]]   = -elements[i]->h[0];
-            }
-            index += n;
-        }
-        // LU factorization
-        for (int i=0; i<n-1; i++)
-        {
-            for (int k=i+1; k<n; k++)
-            {
-                a_matrix[k*n+i] /= a_matrix[i*n+i];
-                for (int j=i+1; j<n; j++)
-                {
-                    a_matrix[k*n+j] -= a_matrix[k*n+i] * a_matrix[i*n+j];
-                }
-            }
-        }
-    }
-
-    // Setup vector b
-    phi_int_residents = residents_at_home (sim_clock->daytime) * 5. * 2. * (32.-temp_int_air_prev);
-    phi_int_app = heat_loss_app * 1000.;
-    phi_int = phi_int_residents + phi_int_app;
-    phi_sol = 0.;
-    value = ((1-f_int_c)*phi_int + (1-f_sol_c)*phi_sol + (1-f_HC_c)*phi_HC) / area_tot;
-    b_vector[0] = (C_int/delta_t)*temp_int_air_prev + f_int_c*phi_int + f_sol_c*phi_sol + f_HC_c*phi_HC;
-    index = 1;
-    for (int i=0; i<num_elements; i++)
-    {
-        b_vector[index++] = value;
-        if (elements[i]->num_nodes == 5)
-        {
-            for (int j=1; j<=3; j++)
-            {
-                b_vector[index++] = elements[i]->node_temp_prev[j] * elements[i]->kappa[j-1]/delta_t;
-            }
-        }
-        b_vector[index++] = (elements[i]->h_ce + elements[i]->h_re) * location->temperature - elements[i]->phi_sky;
-    }
-
-    // Solve the linear system. The result is stored in vector b.
-    double *row_start;
-    for (int i=1; i<n; i++)
-    {
-        row_start = a_matrix+i*n;
-        for (int j=0; j<i; j++)
-        {
-            //b_vector[i] -= a_matrix[i*n+j] * b_vector[j];
-            b_vector[i] -= *(row_start+j) * b_vector[j];
-        }
-    }
-    for (int i=n-1; i>=0; i--)
-    {
-        row_start = a_matrix+i*n;
-        for (int j=i+1; j<n; j++)
-        {
-            b_vector[i] -= *(row_start+j) * b_vector[j];
-        }
-        b_vector[i] /= *(row_start+i);
-    }
-    temp_int_air = b_vector[0];
-    double sum = 0.;
+    area_tot = 0.;
     for (int i=0; i<num_elements; i++)
     {
-        sum += elements[i]->area * b_vector[offsets[i]];
-        for (int j=0; j<elements[i]->num_nodes; j++) elements[i]->node_temp[j] = b_vector[offsets[i]+j];
+        num_nodes += elements[i]->num_nodes;
+        area_tot += elements[i]->area;
     }
-    double temp_op = 0.5 * (temp_int_air + sum/area_tot);
-    return temp_op;
 }
 
 
-void Household::space_heating_and_cooling_demand (void)
-{
-    double temp_int_op_0;
-    double temp_int_op_upper;
+// The set temperatures are updated by each household, the heating and cooling
+// demand is calculated afterwards for all households at once (see ThermalBatch)
 
+void Household::set_temperatures (void)
+{
     if (reduce_heat)
     {
  //       if (sim_clock->daytime >= bedtime || sim_clock->daytime < wakeup-7200)
@@ -2236,40 +2489,11 @@ void Household::space_heating_and_cooling_demand (void)
             temp_int_set_H = config->household.set_temperature_H_day;
         }
     }
-    heat_demand_SH = cool_demand = 0.;
-    temp_int_op_0 = operative_temperature (0.);  // operative temperature without any heating or cooling
-    if (temp_int_op_0 < temp_int_set_H && sim_clock->heating_period) // activation of the heating is required
+    if (!vent_initialized)
     {
-        temp_int_op_upper = operative_temperature (max_heat_power * 1000.); // operative temperature with heating enabled at max.power
-        if (temp_int_op_upper < temp_int_set_H)
-        {
-            heat_demand_SH = max_heat_power;
-        }
-        else
-        {
-            heat_demand_SH = max_heat_power * (temp_int_set_H - temp_int_op_0) / (temp_int_op_upper - temp_int_op_0);
-            operative_temperature (heat_demand_SH * 1000.);  // calculate temperatures for the actual amount of heat power
-        }
+        if (config->ventilation_model) heat_transfer_vent = heat_transfer_ventilation();
+        vent_initialized = true;
     }
-    else if (aircon && temp_int_op_0 > temp_int_set_C)  // aircon available && cooling needed ?
-    {
-        temp_int_op_upper = operative_temperature (-max_cool_power * 1000.); // operative temperature with cooling enabled at max.power
-        if (temp_int_op_upper > temp_int_set_C)
-        {
-            cool_demand = max_cool_power;
-        }
-        else
-        {
-            cool_demand = max_cool_power * (temp_int_op_0 - temp_int_set_C) / (temp_int_op_0 - temp_int_op_upper);
-            operative_temperature (-cool_demand * 1000.);  // calculate temperatures for the actual amount of cooling power
-        }
-    }
-    // save temperatures for the next timestep
-    for (int i=0; i<num_elements; i++)
-    {
-        for (int j=0; j<elements[i]->num_nodes; j++) elements[i]->node_temp_prev[j] = elements[i]->node_temp[j];
-    }
-    temp_int_air_prev = temp_int_air;
 }
 
 
@@ -2352,42 +2576,115 @@ double Household::heat_transfer_ventilation (void)
 }
 
 
+// The households are ordered by the key ('vacation', household number). Return
+// the number of households of all processes whose key is below 'key', where
+// 'min' is the smallest value of 'vacation'. 'vacation_list' is sorted by this
+// key, since the local households are numbered in ascending order and the
+// counting sort in update_vacation() keeps their order.
+
+int Household::vacation_keys_below (long long key, int min)
+{
+    int lower = 0, upper = local_count, below;
+
+    while (lower < upper)
+    {
+        int mid = (lower + upper)/2;
+        Household *h = vacation_list[mid];
+        if ((long long)(h->vacation - min) * global_count + h->number - 1 < key) lower = mid+1;
+        else upper = mid;
+    }
+#ifdef PARALLEL
+    MPI_Allreduce (&lower, &below, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#else
+    below = lower;
+#endif
+    return below;
+}
+
+
 void Household::update_vacation()
 {
     // Determine which households are on vacation. This function is called once
-    // at the start of each day.
+    // at the start of each day by all processes. The households which go on
+    // vacation are the ones with the smallest value of 'vacation', the ones
+    // which come back are those with the largest values, the household number
+    // decides among equal values. Since the choice is made among all households,
+    // it doesn't depend on the number of processes or their share of households.
 
     int num_hh_on_vacation = 0;  // number of households currently on vacation
-    int delta;
-    class Household **list = NULL;      // a list of household pointers used for sorting
+    int delta, target, min = INT_MAX, max = -INT_MAX, range, local_below;
+    long long lower, upper;
+    class Household **list;      // the households sorted by 'vacation'
+
+    if (global_count == 0) return;
+    if (!vacation_list) alloc_memory (&vacation_list, local_count > 0 ? local_count : 1, "Household::update_vacation");
+    list = vacation_list;
+
+    for (int i=0; i<local_count; i++)
+    {
+        hh[i].vacation--;
+        if (hh[i].vacation < min) min = hh[i].vacation;
+        if (hh[i].vacation > max) max = hh[i].vacation;
+        if (hh[i].vacation > 0) num_hh_on_vacation++;
+    }
+#ifdef PARALLEL
+    int limits[2] = {min, -max};
+    MPI_Allreduce (MPI_IN_PLACE, limits, 2, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce (MPI_IN_PLACE, &num_hh_on_vacation, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    min = limits[0];
+    max = -limits[1];
+#endif
 
-    alloc_memory (&list, local_count, "Household::update_vacation");
-    for (int i=0; i<local_count; i++) 
+    // 'vacation' counts down by one every day, so its range grows by one day at most.
+    // A counting sort is linear and stable, i.e. households with the same value
+    // keep their order.
+    range = max-min+1;
+    if (range > max_vacation_count)
     {
-        list[i] = hh+i;
-        list[i]->vacation--;
+        delete [] vacation_count;
+        max_vacation_count = 2*range;
+        alloc_memory (&vacation_count, max_vacation_count, "Household::update_vacation");
     }
-    qsort (list, (size_t)local_count, sizeof(class Household*), &compare_households_vacation);
-    for (int h=local_count-1; h>=0; h--) if (list[h]->vacation > 0) num_hh_on_vacation++;
-    delta = (int)(local_count * config->household.vacation_percentage[sim_clock->month-1][sim_clock->day-1] / 100. + 0.5)
+    for (int v=0; v<range; v++) vacation_count[v] = 0;
+    for (int i=0; i<local_count; i++) vacation_count[hh[i].vacation-min]++;
+    for (int v=0, pos=0; v<range; v++)
+    {
+        int num = vacation_count[v];
+        vacation_count[v] = pos;
+        pos += num;
+    }
+    for (int i=0; i<local_count; i++) list[vacation_count[hh[i].vacation-min]++] = hh+i;
+    delta = (int)(global_count * config->household.vacation_percentage[sim_clock->month-1][sim_clock->day-1] / 100. + 0.5)
             - num_hh_on_vacation;
+    if (delta == 0) return;
+
+    // The keys are unique, so there is a key with exactly 'target' households
+    // below it. Find it by bisection, the local households below it are the
+    // first ones in the list.
+    target = delta > 0 ? delta : global_count + delta;
+    lower = 0;
+    upper = (long long)range * global_count;
+    while (lower < upper)
+    {
+        long long mid = lower + (upper-lower)/2;
+        if (vacation_keys_below (mid, min) < target) lower = mid+1;
+        else upper = mid;
+    }
+    local_below = 0;
+    while (local_below < local_count
+           && (long long)(list[local_below]->vacation - min) * global_count + list[local_below]->number - 1 < lower) local_below++;
+
     if (delta > 0)      // send more households on vacation
     {
-        for (int h=0; h<delta; h++) list[h]->vacation = get_random_number (3, 4);
+        for (int h=0; h<local_below; h++)
+        {
+            select_random_stream (&list[h]->rng);
+            list[h]->vacation = get_random_number (3, 4);
+        }
+        select_random_stream (NULL);
     }
-    else if (delta < 0) // end vacation for some households
+    else                // end vacation for some households
     {
-        for (int h=0; h>delta; h--) list[local_count-1+h]->vacation = 0;
-    }   
-    delete [] list;
-}
-
-static int compare_households_vacation (const void *h1, const void *h2)
-{
-    Household *ptr1 = *(Household**)h1;
-    Household *ptr2 = *(Household**)h2;
-    int delta = ptr1->vacation - ptr2->vacation;
-    if (delta > 0) return 1;
-    else if (delta < 0) return -1;
-    return 0;
+        for (int h=local_below; h<local_count; h++) list[h]->vacation = 0;
+    }
 }
@@ -51,8 +51,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Light::Light (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     status = OFF;
     timer = 0;
@@ -105,7 +103,7 @@ void Light::simulate()
 {
     double daytime = sim_clock->daytime;
 
-    timer--;
+    timer -= wake_up();
 
     // At the beginning of each day decide when to turn on the lamps
 
@@ -142,4 +140,5 @@ void Light::simulate()
         increase_consumption();
         household->heat_loss_app += power.real*0.95;
     }
+    if (status == OFF) sleep (steps_until (time_1, time_2));
 }
@@ -42,20 +42,35 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #ifdef _WIN32
 #   include <io.h>
+#   include <process.h>
 #   define F_OK 0
 #else
 #   include <unistd.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
 #endif
 #ifdef HAVE_CURL
 #include <curl/curl.h>
 #endif
+#ifdef PARALLEL
+#include <mpi.h>
+#endif
 
 #include "globals.H"
 #include "proto.H"
 #include "types.H"
 #include "location.H"
+#include "profiler.H"
+
+const int32_t k_cache_version = 1;
+const uint64_t k_fnv_offset_basis = 14695981039346656037ULL;
+const uint64_t k_fnv_prime = 1099511628211ULL;
+
+static uint64_t hash_file (const char file_name[], uint64_t hash);
 
 /*
  The irradiation and temperature data is provided by PVGIS:
@@ -75,7 +90,6 @@ Location::Location (char location_name[], int year, char pv_data_file_name[], ch
     const char function_name[] = "Location::Location";
     FILE *fp = NULL;
     char file_name[k_name_length], type_name[k_name_length], keyword[k_name_length];
-    char *line = NULL;
     int num_years;
     int initial_date, initial_time;
 #ifdef HAVE_CURL
@@ -163,6 +177,115 @@ Location::Location (char location_name[], int year, char pv_data_file_name[], ch
     {
         snprintf (file_name, sizeof (file_name), "locations/%s/%s", name, pv_data_file_name);
     }
+
+    // The timelines are taken from a binary cache file next to the data file,
+    // which is rebuilt whenever the hash of the data (and forecast) file changes.
+    // Only rank 0 reads the text files, all other processes map the cache.
+
+    bool use_forecast = charging_strategy > 0 && forecast_method == 3;
+    char forecast_file_name[k_name_length], cache_file_name[k_name_length+8];
+    if (use_forecast)
+    {
+        if (!strlen (pv_forecast_file_name))
+        {
+            fprintf (stderr, "The name of a solar forecast file must be specified in resLoadSIM.json when setting production_forecast_method = 3\n");
+            exit (1);
+        }
+        snprintf (forecast_file_name, sizeof (forecast_file_name), "locations/%s/%s", name, pv_forecast_file_name);
+    }
+    snprintf (cache_file_name, sizeof (cache_file_name), "%s.cache", file_name);
+
+    uint64_t hash = 0;
+    int cache_ok = 0;
+    cache_data = NULL;
+    forecast_timeline = NULL;
+    if (rank == 0)
+    {
+        hash = hash_file (file_name, k_fnv_offset_basis);
+        if (use_forecast) hash = hash_file (forecast_file_name, hash);
+        cache_ok = map_cache (cache_file_name, hash, use_forecast);
+        if (!cache_ok)
+        {
+            read_pv_data (file_name, &initial_date, &initial_time);
+            if (use_forecast) read_forecast (forecast_file_name, initial_date, initial_time);
+            cache_ok = write_cache (cache_file_name, hash);
+        }
+    }
+#ifdef PARALLEL
+    MPI_Bcast (&cache_ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast (&hash, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (rank > 0 && !(cache_ok && map_cache (cache_file_name, hash, use_forecast)))
+    {
+        read_pv_data (file_name, &initial_date, &initial_time);
+        if (use_forecast) read_forecast (forecast_file_name, initial_date, initial_time);
+    }
+#endif
+    num_years = last_year - first_year + 1;
+    update_year_ts (year);
+
+    // Calculate the mean temperatures for the years FIRST to LAST
+    // and find the coldest day of each year
+
+    alloc_memory (&temp_ambient_mean, num_years, function_name);
+    alloc_memory (&coldest_day, num_years, function_name);
+    int num_entries_per_day;
+    if (is_PVGIS) num_entries_per_day = 24; else num_entries_per_day = 24 * 12;
+    for (int y=0; y<num_years; y++)
+    {
+        temp_ambient_mean[y] = 0.;
+        double lowest_temp = 12345.;
+        int lowest_temp_index = 0;
+        for (int i=offset_year[y]*num_entries_per_day; i<offset_year[y+1]*num_entries_per_day; i++)
+        {
+            temp_ambient_mean[y] += temperature_timeline[i];
+            if (temperature_timeline[i] < lowest_temp)
+            {
+                lowest_temp = temperature_timeline[i];
+                lowest_temp_index = i;
+            }
+        }
+        temp_ambient_mean[y] /= (offset_year[y+1]-offset_year[y])*num_entries_per_day;
+        coldest_day[y] = lowest_temp_index/num_entries_per_day - offset_year[y] + 1;
+    }
+    irradiance_integral = 0.;
+    temp_H2O_cold_0 = 10.;
+}
+
+
+Location::~Location()
+{
+    delete [] coldest_day;
+    delete [] temp_ambient_mean;
+    if (cache_data)
+    {
+#ifdef _WIN32
+        delete [] cache_data;
+#else
+        munmap (cache_data, cache_size);
+#endif
+    }
+    else
+    {
+        delete [] offset_year;
+        delete [] irradiance_timeline;
+        delete [] temperature_timeline;
+        if (forecast_timeline) delete [] forecast_timeline;
+    }
+}
+
+
+// Read the irradiance and temperature timelines from a PVGIS file or a file
+// in the custom format
+
+void Location::read_pv_data (const char file_name[], int *initial_date, int *initial_time)
+{
+    const char function_name[] = "Location::read_pv_data";
+    FILE *fp = NULL;
+    char *line = NULL;
+    int num_years;
+    int *offsets;
+    double *irradiance, *temperature;
+
     open_file (&fp, file_name, "r");
 
     // Skip the file header depending on whether it is a PVGIS file or a custom format
@@ -183,8 +306,8 @@ Location::Location (char location_name[], int year, char pv_data_file_name[], ch
     read_line (fp, &line);
     if (is_PVGIS)
     {
-        sscanf (line, "%d:%d", &initial_date, &initial_time);
-        first_year = initial_date/10000;
+        sscanf (line, "%d:%d", initial_date, initial_time);
+        first_year = *initial_date/10000;
     }
     else
     {
@@ -199,114 +322,256 @@ Location::Location (char location_name[], int year, char pv_data_file_name[], ch
     num_years = last_year - first_year + 1;
     fseek (fp, file_pos, SEEK_SET);
 
-    update_year_ts (year);
-
     // Allocate memory for storing irradiation/solar_output and temperature data
 
-    alloc_memory (&offset_year, num_years+1, function_name);
+    alloc_memory (&offsets, num_years+1, function_name);
     num_entries = 0;
-    offset_year[0] = 0;
+    offsets[0] = 0;
     int index = 1;
     for (int y=first_year; y<=last_year; y++)
     {
         if (y%4==0 && (y%100>0 || y%400==0)) num_entries += 366;   // leap year
         else num_entries += 365;
-        offset_year[index++] = num_entries;
+        offsets[index++] = num_entries;
     }
     if (is_PVGIS) num_entries *= 24;
     else num_entries *= 24 * 12;
-    alloc_memory (&irradiance_timeline, num_entries, function_name);
-    alloc_memory (&temperature_timeline, num_entries, function_name);
+    alloc_memory (&irradiance, num_entries, function_name);
+    alloc_memory (&temperature, num_entries, function_name);
 
     // Read the PV data file
 
     for (int i=0; i<num_entries; i++)
     {
         read_line (fp, &line);
-        if (is_PVGIS) sscanf (line, "%*d:%*d,%lf,%*f,%lf,%*f,%*d", irradiance_timeline+i, temperature_timeline+i);
-        else          sscanf (line, "%*s %*s %lf %lf", irradiance_timeline+i, temperature_timeline+i);
+        if (is_PVGIS) sscanf (line, "%*d:%*d,%lf,%*f,%lf,%*f,%*d", irradiance+i, temperature+i);
+        else          sscanf (line, "%*s %*s %lf %lf", irradiance+i, temperature+i);
     }
     fclose (fp);
+    free (line);
+    offset_year = offsets;
+    irradiance_timeline = irradiance;
+    temperature_timeline = temperature;
+}
 
-    if (charging_strategy > 0 && forecast_method == 3)
-    {
-        // Open the file that contains the solar radiation forecast for this location.
-        if (!strlen (pv_forecast_file_name))
-        {
-            fprintf (stderr, "The name of a solar forecast file must be specified in resLoadSIM.json when setting production_forecast_method = 3\n");
-            exit (1);
-        }
-        snprintf (file_name, sizeof (file_name), "locations/%s/%s", name, pv_forecast_file_name);
-        open_file (&fp, file_name, "r");
 
-        // Remove the file header
-        for (int i=0; i<9; i++) read_line (fp, &line); // skip the remaining header lines
+// Read the forecast of the irradiance, which must start at the same date
+// and time as the PV data file
 
-        // Allocate memory for storing the forecast data
-        alloc_memory (&forecast_timeline, num_entries, function_name);
+void Location::read_forecast (const char file_name[], int initial_date, int initial_time)
+{
+    FILE *fp = NULL;
+    char *line = NULL;
+    double *forecast;
+
+    open_file (&fp, file_name, "r");
+
+    // Remove the file header
+    for (int i=0; i<9; i++) read_line (fp, &line); // skip the remaining header lines
+
+    // Allocate memory for storing the forecast data
+    alloc_memory (&forecast, num_entries, "Location::read_forecast");
 
-        // Read the first line with solar data and check whether the initial date and time matches the PVGIS file's initial date and time
-        int initial_date_fc, initial_time_fc;
+    // Read the first line with solar data and check whether the initial date and time matches the PVGIS file's initial date and time
+    int initial_date_fc, initial_time_fc;
+    read_line (fp, &line);
+    sscanf (line, "%d:%d,%lf", &initial_date_fc, &initial_time_fc, forecast);
+    if (initial_date_fc != initial_date || initial_time_fc != initial_time)
+    {
+        fprintf (stderr, "The initial date/time of the forecast file must match the initial date/time of the PVGIS file\n");
+        exit (1);
+    }
+    // Read the forecast data file
+    for (int i=1; i<num_entries; i++)
+    {
         read_line (fp, &line);
-        sscanf (line, "%d:%d,%lf", &initial_date_fc, &initial_time_fc, forecast_timeline);
-        if (initial_date_fc != initial_date || initial_time_fc != initial_time)
-        {
-            fprintf (stderr, "The initial date/time of the forecast file must match the initial date/time of the PVGIS file\n");
-            exit (1);
-        }
-        // Read the forecast data file
-        for (int i=1; i<num_entries; i++)
-        {
-            read_line (fp, &line);
-            sscanf (line, "%*d:%*d,%lf", forecast_timeline+i);
-        }
-        fclose (fp);
+        sscanf (line, "%*d:%*d,%lf", forecast+i);
     }
-    else forecast_timeline = NULL;
+    fclose (fp);
     free (line);
+    forecast_timeline = forecast;
+}
 
-    // Calculate the mean temperatures for the years FIRST to LAST
-    // and find the coldest day of each year
 
-    alloc_memory (&temp_ambient_mean, num_years, function_name);
-    alloc_memory (&coldest_day, num_years, function_name);
-    int num_entries_per_day;
-    if (is_PVGIS) num_entries_per_day = 24; else num_entries_per_day = 24 * 12;
-    for (int y=0; y<num_years; y++)
+// FNV-1a hash of a file's content, continuing from 'hash'
+
+static uint64_t hash_file (const char file_name[], uint64_t hash)
+{
+    FILE *fp = NULL;
+    unsigned char buffer[65536];
+    size_t n;
+
+    open_file (&fp, file_name, "rb");
+    while ((n = fread (buffer, 1, sizeof (buffer), fp)) > 0)
     {
-        temp_ambient_mean[y] = 0.;
-        double lowest_temp = 12345.;
-        int lowest_temp_index = 0;
-        for (int i=offset_year[y]*num_entries_per_day; i<offset_year[y+1]*num_entries_per_day; i++)
+        for (size_t i=0; i<n; i++)
         {
-            temp_ambient_mean[y] += temperature_timeline[i];
-            if (temperature_timeline[i] < lowest_temp)
-            {
-                lowest_temp = temperature_timeline[i];
-                lowest_temp_index = i;
-            }
+            hash ^= buffer[i];
+            hash *= k_fnv_prime;
         }
-        temp_ambient_mean[y] /= (offset_year[y+1]-offset_year[y])*num_entries_per_day;
-        coldest_day[y] = lowest_temp_index/num_entries_per_day - offset_year[y] + 1;
     }
-    irradiance_integral = 0.;
-    temp_H2O_cold_0 = 10.;
+    fclose (fp);
+    return hash;
 }
 
 
-Location::~Location()
+// Layout of the cache file: the header, offset_year (padded to a multiple
+// of 8 bytes), the irradiance, the temperature and (optionally) the forecast
+// timeline. It's only meant to be read by the same build of resLoadSIM.
+
+struct CacheHeader
 {
-    delete [] offset_year;
-    delete [] coldest_day;
-    delete [] temp_ambient_mean;
-    delete [] irradiance_timeline;
-    delete [] temperature_timeline;
-    if (forecast_timeline) delete [] forecast_timeline;
+    char magic[4];          // "RLSC"
+    int32_t version;
+    uint64_t hash;          // hash of the data file and the forecast file
+    int32_t is_PVGIS;
+    int32_t first_year;
+    int32_t last_year;
+    int32_t num_entries;
+    int32_t has_forecast;
+    int32_t reserved;
+};
+
+static size_t offsets_size (int num_years)
+{
+    return ((num_years+1)*sizeof(int32_t) + 7) / 8 * 8;
+}
+
+
+// Map a cache file into memory and let the timelines point to it. Returns
+// false if the file doesn't exist or doesn't match the hash.
+
+bool Location::map_cache (const char cache_file_name[], uint64_t hash, bool use_forecast)
+{
+    CacheHeader header;
+    FILE *fp = fopen (cache_file_name, "rb");
+
+    if (!fp) return false;
+    size_t n = fread (&header, sizeof (header), 1, fp);
+    fclose (fp);
+    if (   n != 1
+        || strncmp (header.magic, "RLSC", 4)
+        || header.version != k_cache_version
+        || header.hash != hash
+        || header.has_forecast != (int32_t)use_forecast)
+    {
+        return false;
+    }
+
+    int num_years = header.last_year - header.first_year + 1;
+    size_t size = sizeof (header) + offsets_size (num_years)
+                  + (2 + header.has_forecast) * header.num_entries * sizeof (double);
+#ifdef _WIN32
+    char *data;
+    alloc_memory (&data, size, "Location::map_cache");
+    fp = fopen (cache_file_name, "rb");
+    if (!fp)
+    {
+        delete [] data;
+        return false;
+    }
+    n = fread (data, 1, size, fp);
+    fclose (fp);
+    if (n != size)
+    {
+        delete [] data;
+        return false;
+    }
+#else
+    int fd = open (cache_file_name, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat (fd, &st) || (size_t)st.st_size != size)
+    {
+        ::close (fd);
+        return false;
+    }
+    void *map = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (map == MAP_FAILED) return false;
+    char *data = (char *)map;
+#endif
+    cache_data = data;
+    cache_size = size;
+    is_PVGIS = header.is_PVGIS;
+    first_year = header.first_year;
+    last_year = header.last_year;
+    num_entries = header.num_entries;
+    data += sizeof (header);
+    offset_year = (const int *)data;
+    data += offsets_size (num_years);
+    irradiance_timeline = (const double *)data;
+    data += num_entries * sizeof (double);
+    temperature_timeline = (const double *)data;
+    data += num_entries * sizeof (double);
+    forecast_timeline = header.has_forecast ? (const double *)data : NULL;
+    return true;
+}
+
+
+// Write the timelines read from the text files to a cache file. The file is
+// written under a temporary name first, so that other runs never see a
+// partially written cache. The name is unique, so that runs sharing the
+// locations directory don't write to the same temporary file.
+
+bool Location::write_cache (const char cache_file_name[], uint64_t hash)
+{
+    char tmp_file_name[k_name_length+16];
+    CacheHeader header;
+    int num_years = last_year - first_year + 1;
+    char padding[8] = {0};
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, "RLSC", 4);
+    header.version = k_cache_version;
+    header.hash = hash;
+    header.is_PVGIS = is_PVGIS;
+    header.first_year = first_year;
+    header.last_year = last_year;
+    header.num_entries = num_entries;
+    header.has_forecast = forecast_timeline != NULL;
+
+#ifdef _WIN32
+    snprintf (tmp_file_name, sizeof (tmp_file_name), "%s.%d.tmp", cache_file_name, _getpid());
+    FILE *fp = fopen (tmp_file_name, "wb");
+    if (!fp) return false;
+#else
+    snprintf (tmp_file_name, sizeof (tmp_file_name), "%s.XXXXXX", cache_file_name);
+    int fd = mkstemp (tmp_file_name);
+    if (fd < 0) return false;
+    fchmod (fd, 0644);      // mkstemp creates the file readable by its owner only
+    FILE *fp = fdopen (fd, "wb");
+    if (!fp)
+    {
+        close (fd);
+        remove (tmp_file_name);
+        return false;
+    }
+#endif
+    bool ok = fwrite (&header, sizeof (header), 1, fp) == 1;
+    for (int y=0; y<=num_years; y++)
+    {
+        int32_t offset = offset_year[y];
+        ok = ok && fwrite (&offset, sizeof (offset), 1, fp) == 1;
+    }
+    size_t pad = offsets_size (num_years) - (num_years+1)*sizeof(int32_t);
+    ok = ok && fwrite (padding, 1, pad, fp) == pad;
+    ok = ok && fwrite (irradiance_timeline, sizeof (double), num_entries, fp) == (size_t)num_entries;
+    ok = ok && fwrite (temperature_timeline, sizeof (double), num_entries, fp) == (size_t)num_entries;
+    if (forecast_timeline)
+    {
+        ok = ok && fwrite (forecast_timeline, sizeof (double), num_entries, fp) == (size_t)num_entries;
+    }
+    ok = fclose (fp) == 0 && ok;
+    if (ok) ok = rename (tmp_file_name, cache_file_name) == 0;
+    if (!ok) remove (tmp_file_name);
+    return ok;
 }
 
 
 void Location::update_values()
 {
+    ProfileScope scope (PROFILE_LOCATION);
     int this_day, pos_of_day, index, year;
     int offset_month[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
     int offset_month_leap[12] = {0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335};
@@ -44,9 +44,18 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 #ifdef PARALLEL
 #include <mpi.h>
 #endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "appliance.H"
 #include "household.H"
@@ -59,6 +68,8 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "output.H"
 #include "solarmodule.H"
 #include "solarcollector.H"
+#include "checkpoint.H"
+#include "profiler.H"
 #include "globals.H"
 
 // Global variable definition
@@ -67,6 +78,7 @@ class Configuration *config = NULL;
 class Location *location = NULL;
 class Clock *sim_clock = NULL;
 class Powerflow *powerflow = NULL;
+class Writer *writer = NULL;
 double table_DHW_saturday[1440];
 double table_DHW_sunday[1440];
 double table_DHW_weekday[1440];
@@ -76,6 +88,8 @@ FILE *debug_file;
 #endif
 
 // Local function prototypes
+void run_simulation (class Output *output, class Producer *producer);
+void run_scenarios (class Output *output, class Producer *producer, int num_households, double num_days);
 void reset_integral_values();
 void print_results (class Output *output, int year);
 
@@ -91,7 +105,18 @@ int main (int argc, char **argv)
     double forerun_time;    // in seconds
 
 #ifdef PARALLEL
+#ifdef _OPENMP
+    // Only the master thread of each process calls MPI routines
+    int thread_support;
+    MPI_Init_thread (&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
+    if (thread_support < MPI_THREAD_FUNNELED)
+    {
+        fprintf (stderr, "The MPI library does not support multithreading\n");
+        MPI_Abort (MPI_COMM_WORLD, 1);
+    }
+#else
     MPI_Init (&argc, &argv);
+#endif
     MPI_Comm_rank (MPI_COMM_WORLD, &rank);
     MPI_Comm_size (MPI_COMM_WORLD, &num_processes);
 #else
@@ -100,87 +125,57 @@ int main (int argc, char **argv)
 #endif
     parse_arguments (argc, argv, &num_households, &num_days, &silent_mode);
     alloc_memory (&config, 1, "main");
+    init_random();
+    if (config->checkpoint.restart) Checkpoint::open (num_households);
     alloc_memory (&sim_clock, 1, "main");
+    alloc_memory (&writer, 1, "main");
+#ifdef _OPENMP
+    if (config->num_threads > 0) omp_set_num_threads (config->num_threads);
+#endif
     sim_clock->end_time = num_days * 24 * 3600;
     sim_clock->cur_time = 0;
     location->update_values();
 #ifdef PARALLEL
 MPI_Barrier (MPI_COMM_WORLD);
 #endif
-    init_random();
 
     if (rank == 0)
     {
-        output.remove_old_files();
+        if (config->checkpoint.restart != 1) output.remove_old_files();
         config->print_log (num_households, num_days);
     }
     Household::allocate_memory (num_households);
     alloc_memory (&producer, 1, "main");
     Household::producer = producer;
     if (config->powerflow.step_size) powerflow = new class Powerflow (num_households);
+    Profiler::init();
 
-    // Start a pre-simulation run so that the transient oscillations have time to settle
-    // before the actual simulation starts. Other reasons for a pre-simulation run are:
-    // • When using peak shaving we need to have a reference value for the
-    //   maximum power peak.
-    // • In case there are households with a PV installation with batteries we
-    //   need to initialize the batteries properly.
-
-    if (!silent_mode && rank == 0)
+    if (config->checkpoint.restart)
     {
-        printf ("\nPre-run phase 1 (transient time):     "); fflush (stdout);
+        // All of the following has already been done before the checkpoint was written
+        Checkpoint::read (&output, producer);
     }
-    transient_time = config->transient_time * 24 * 3600;  // convert from days to seconds
-    while (sim_clock->cur_time < transient_time)
+    else
     {
-        location->update_values();
-        Household::simulate_forerun();
-        sim_clock->forward();
-        completed = (int)((sim_clock->cur_time/transient_time)*100.0);
-        if (!silent_mode && rank == 0 && completed > completed_old)
-        {
-            printf ("\b\b\b\b%3d%%", completed);
-            fflush (stdout);
-            completed_old = completed;
-        }
-    }
-    reset_integral_values();
-
-    // If the annual production of the PV modules is given as a fraction of the
-    // annual household consumption, we need to calculate the annual consumption in
-    // advance. So let's start another pre-simulation run...
+        // Start a pre-simulation run so that the transient oscillations have time to settle
+        // before the actual simulation starts. Other reasons for a pre-simulation run are:
+        // • When using peak shaving we need to have a reference value for the
+        //   maximum power peak.
+        // • In case there are households with a PV installation with batteries we
+        //   need to initialize the batteries properly.
 
-    if (   (config->solar_module.production_ratio > 0 && SolarModule::count > 0)
-        || (config->battery.capacity_in_days > 0 && Battery::count > 0))
-    {
+        Profiler::start (PROFILE_PRERUN);
         if (!silent_mode && rank == 0)
         {
-            printf ("\nPre-run phase 2 (one year):   0%%"); fflush (stdout);
-            completed_old = 0;
+            printf ("\nPre-run phase 1 (transient time):     "); fflush (stdout);
         }
-        int y=0;
-        while (   y<config->num_ref_years
-               && (   config->solar_production_reference_year[y]%4==0
-                   && (config->solar_production_reference_year[y]%100>0 || config->solar_production_reference_year[y]%400==0))) y++;
-        if (y == config->num_ref_years) // haven't found a non-leap year among the reference years
-        {
-            sim_clock->set_date_time (1, 1, config->solar_production_reference_year[0], 0.);    // take the first reference year
-        }
-        else
-        {
-            sim_clock->set_date_time (1, 1, config->solar_production_reference_year[y], 0.);    // take the reference year at position y
-        }
-        sim_clock->forerun = true;
-        Household::deactivate_batteries();
-        forerun_time = k_seconds_per_year;
-        sim_clock->cur_time = 0.;
-        while (sim_clock->cur_time < forerun_time)
+        transient_time = config->transient_time * 24 * 3600;  // convert from days to seconds
+        while (sim_clock->cur_time < transient_time)
         {
             location->update_values();
-            if (sim_clock->midnight) Household::update_vacation();
             Household::simulate_forerun();
             sim_clock->forward();
-            completed = (int)((sim_clock->cur_time/forerun_time)*100.0);
+            completed = (int)((sim_clock->cur_time/transient_time)*100.0);
             if (!silent_mode && rank == 0 && completed > completed_old)
             {
                 printf ("\b\b\b\b%3d%%", completed);
@@ -188,47 +183,124 @@ MPI_Barrier (MPI_COMM_WORLD);
                 completed_old = completed;
             }
         }
-        if (config->solar_module.production_ratio > 0 && SolarModule::count > 0)
-        {
-            Household::adapt_pv_module_size();
-        }
-        if (config->battery.capacity_in_days > 0 && Battery::count > 0)
+        reset_integral_values();
+
+        // If the annual production of the PV modules is given as a fraction of the
+        // annual household consumption, we need to calculate the annual consumption in
+        // advance. So let's start another pre-simulation run...
+
+        if (   (config->solar_module.production_ratio > 0 && SolarModule::count > 0)
+            || (config->battery.capacity_in_days > 0 && Battery::count > 0))
         {
-            Household::adapt_battery_capacity();
+            if (!silent_mode && rank == 0)
+            {
+                printf ("\nPre-run phase 2 (one year):   0%%"); fflush (stdout);
+                completed_old = 0;
+            }
+            int y=0;
+            while (   y<config->num_ref_years
+                   && (   config->solar_production_reference_year[y]%4==0
+                       && (config->solar_production_reference_year[y]%100>0 || config->solar_production_reference_year[y]%400==0))) y++;
+            if (y == config->num_ref_years) // haven't found a non-leap year among the reference years
+            {
+                sim_clock->set_date_time (1, 1, config->solar_production_reference_year[0], 0.);    // take the first reference year
+            }
+            else
+            {
+                sim_clock->set_date_time (1, 1, config->solar_production_reference_year[y], 0.);    // take the reference year at position y
+            }
+            sim_clock->forerun = true;
+            Household::deactivate_batteries();
+            forerun_time = k_seconds_per_year;
+            sim_clock->cur_time = 0.;
+            while (sim_clock->cur_time < forerun_time)
+            {
+                location->update_values();
+                if (sim_clock->midnight) Household::update_vacation();
+                Household::simulate_forerun();
+                sim_clock->forward();
+                completed = (int)((sim_clock->cur_time/forerun_time)*100.0);
+                if (!silent_mode && rank == 0 && completed > completed_old)
+                {
+                    printf ("\b\b\b\b%3d%%", completed);
+                    fflush (stdout);
+                    completed_old = completed;
+                }
+            }
+            if (config->solar_module.production_ratio > 0 && SolarModule::count > 0)
+            {
+                Household::adapt_pv_module_size();
+            }
+            if (config->battery.capacity_in_days > 0 && Battery::count > 0)
+            {
+                Household::adapt_battery_capacity();
+            }
+            Household::activate_batteries();
+            reset_integral_values();
         }
-        Household::activate_batteries();
-        reset_integral_values();
+
+        sim_clock->set_date_time (config->start.day, config->start.month, config->start.year, config->start.time * 3600);
+        sim_clock->forerun = false;
+        Household::smartification();
+        sim_clock->cur_time = 0.;
+        Profiler::stop (PROFILE_PRERUN);
+        if (config->checkpoint.prerun) Checkpoint::write (true, &output, producer);
     }
 
     // Finally start the proper simulation
 
+    if (config->scenarios.count) run_scenarios (&output, producer, num_households, num_days);
+    else run_simulation (&output, producer);
+    if (!silent_mode && rank == 0) printf ("\n\n");
+    Profiler::report();
+    delete [] sim_clock;
+    delete [] producer;
+    delete powerflow;
+    delete [] writer;
+    delete [] config;
+    Household::deallocate_memory();
+#ifdef PARALLEL
+    MPI_Finalize();
+#endif
+    return 0;
+}
+
+
+void run_simulation (class Output *output, class Producer *producer)
+{
+    int completed, completed_old = 0;
+    int day = 0;
+
     if (!silent_mode && rank == 0)
     {
         printf ("\nSimulation progress:   0%%"); fflush (stdout);
-        completed_old = 0;
     }
-    sim_clock->set_date_time (config->start.day, config->start.month, config->start.year, config->start.time * 3600);
-    sim_clock->forerun = false;
-    Household::smartification();
-    output.open_files();
-    sim_clock->cur_time = 0.;
-    int step = 1;
+    if (config->output_thread) writer->start();
+    output->open_files();
+    int step = (int)(sim_clock->cur_time/config->timestep_size + 0.5) + 1;
+    Profiler::end_of_day (day);     // the pre-simulation runs
+    Profiler::start (PROFILE_SIMULATION);
     while (sim_clock->cur_time < sim_clock->end_time)
     {
-        output.reset();
+        if (sim_clock->midnight && sim_clock->cur_time > 0)
+        {
+            Profiler::stop (PROFILE_SIMULATION);
+            Profiler::end_of_day (++day);
+            Profiler::start (PROFILE_SIMULATION);
+        }
+        output->reset();
+        if (Checkpoint::due()) Checkpoint::write (false, output, producer);
         location->update_values();
         if (sim_clock->midnight) Household::update_vacation();
         Household::simulate();
-        output.print_power();
-        output.print_battery_stats();
-        output.print_gridbalance();
+        output->print();
         if (   (   sim_clock->cur_time > 0
                 && sim_clock->daytime + config->timestep_size >= k_seconds_per_day
                 && sim_clock->day == 31
                 && sim_clock->month == DECEMBER)
             || sim_clock->cur_time + config->timestep_size >= sim_clock->end_time)
         {
-            print_results (&output, sim_clock->year);
+            print_results (output, sim_clock->year);
             reset_integral_values();
         }
         if (config->powerflow.step_size && step%config->powerflow.step_size == 0)
@@ -245,17 +317,114 @@ MPI_Barrier (MPI_COMM_WORLD);
             completed_old = completed;
         }
     }
-    output.close_files();
-    if (!silent_mode && rank == 0) printf ("\n\n");
-    delete [] sim_clock;
-    delete [] producer;
-    delete powerflow;
-    delete [] config;
-    Household::deallocate_memory();
-#ifdef PARALLEL
-    MPI_Finalize();
+    output->close_files();
+    writer->stop();
+    Profiler::stop (PROFILE_SIMULATION);
+    Profiler::end_of_day (++day);
+}
+
+
+// Run the main simulation for every scenario, starting from the state at the
+// end of the pre-simulation runs. Scenario i runs in the directory 'scenario.<i>'
+// with the settings of Configuration::read_scenario. Without fork the state is
+// restored from a snapshot before each scenario, otherwise every scenario gets
+// a copy of the state in a child process.
+
+void run_scenarios (class Output *output, class Producer *producer, int num_households, double num_days)
+{
+    char directory[32];
+    int failed = 0;
+
+    if (config->scenarios.fork)
+    {
+#if !defined(PARALLEL) && !defined(_WIN32)
+        int running = 0, status;
+        fflush (NULL);
+        for (int i=1; i<=config->scenarios.count; i++)
+        {
+            if (config->scenarios.max_processes > 0 && running == config->scenarios.max_processes)
+            {
+                wait (&status);
+                if (!WIFEXITED (status) || WEXITSTATUS (status)) failed++;
+                running--;
+            }
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                perror ("Unable to start the process of a scenario");
+                exit (1);
+            }
+            if (pid == 0)
+            {
+                snprintf (directory, sizeof (directory), "scenario.%d", i);
+                class Output scenario_output;
+                silent_mode = true;
+#ifdef _OPENMP
+                // The thread pool of the OpenMP runtime is not copied into the child process.
+                // The scenarios are parallel themselves, so the child runs single-threaded.
+                omp_set_num_threads (1);
 #endif
-    return 0;
+                config->read_scenario (directory);
+                if (chdir (directory))
+                {
+                    fprintf (stderr, "Can't change to directory '%s'\n", directory);
+                    exit (1);
+                }
+                output->remove_old_files();
+                config->print_log (num_households, num_days);
+                producer->reconfigure();
+                Profiler::init();
+                run_simulation (&scenario_output, producer);
+                Profiler::report();
+                fflush (NULL);
+                _exit (0);
+            }
+            running++;
+        }
+        while (running > 0)
+        {
+            wait (&status);
+            if (!WIFEXITED (status) || WEXITSTATUS (status)) failed++;
+            running--;
+        }
+        if (!silent_mode && rank == 0) printf ("\n%d scenarios done", config->scenarios.count - failed);
+#endif
+    }
+    else
+    {
+        if (config->scenarios.count > 1) Checkpoint::take_snapshot (output, producer);
+        for (int i=1; i<=config->scenarios.count; i++)
+        {
+            class Output scenario_output;
+            snprintf (directory, sizeof (directory), "scenario.%d", i);
+            if (!silent_mode && rank == 0) printf ("\nScenario %d:", i);
+            config->read_scenario (directory);
+            if (chdir (directory))
+            {
+                fprintf (stderr, "Can't change to directory '%s'\n", directory);
+                exit (1);
+            }
+            if (rank == 0)
+            {
+                output->remove_old_files();
+                config->print_log (num_households, num_days);
+            }
+            producer->reconfigure();
+            if (i > 1) Checkpoint::restore_snapshot (&scenario_output, producer);
+            run_simulation (&scenario_output, producer);
+            if (chdir (".."))
+            {
+                fprintf (stderr, "Can't change back from directory '%s'\n", directory);
+                exit (1);
+            }
+        }
+        Checkpoint::drop_snapshot();
+    }
+    if (failed)
+    {
+        fprintf (stderr, "\n%d of %d scenarios failed\n", failed, config->scenarios.count);
+        exit (1);
+    }
 }
 
 
@@ -286,14 +455,26 @@ void reset_integral_values()
 
 void print_results (class Output *output, int year)
 {
+    Profiler::start (PROFILE_HOUSEHOLDS);
     output->print_households (year);
+    Profiler::stop (PROFILE_HOUSEHOLDS);
+    Profiler::start (PROFILE_CONSUMPTION);
     output->print_consumption (year);
+    Profiler::stop (PROFILE_CONSUMPTION);
+    Profiler::start (PROFILE_COSTS);
     Household::print_costs (year);
     Household::print_heat_consumption (year);
     //Household::print_debug_heat_consumption (year);
+    Profiler::stop (PROFILE_COSTS);
+    Profiler::start (PROFILE_DISTRIBUTION);
     output->print_distribution (year);
+    Profiler::stop (PROFILE_DISTRIBUTION);
+    Profiler::start (PROFILE_SUMMARY);
     output->print_summary (year);
+    Profiler::stop (PROFILE_SUMMARY);
+    Profiler::start (PROFILE_MAX);
     output->print_max (year);
+    Profiler::stop (PROFILE_MAX);
 }
 
 int read_line (FILE *fp, char **line)
@@ -0,0 +1,248 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#ifdef PARALLEL
+#include <mpi.h>
+#endif
+
+#include "constants.H"
+#include "configuration.H"
+#include "proto.H"
+#include "globals.H"
+
+int compare_double (double *val_1, double *val_2);
+
+
+// Medians of values which are distributed among the processes. Every value
+// belongs to one of the groups 1 ... k_max_residents, group 0 comprises all
+// values. 'count', 'min' and 'max' are the global number, minimum and maximum
+// of the values in each group.
+//
+// By default the medians are estimated with a sketch: the values are counted
+// in buckets whose bounds grow by the factor (1+a)/(1-a), with a being the
+// relative accuracy k_median_accuracy. The bucket counts of all processes are
+// summed up in one reduction. With config->exact_median the medians are
+// selected exactly, see select_value().
+
+static void median_sketch (const double values[], const int group[], int num,
+                           const int count[], const double min[], const double max[], double median[]);
+static void median_exact (const double values[], const int group[], int num,
+                          const int count[], double median[]);
+
+
+void calc_medians (const double values[], const int group[], int num,
+                   const int count[], const double min[], const double max[], double median[])
+{
+    for (int g=0; g<=k_max_residents; g++) median[g] = 0.;
+    if (config->exact_median) median_exact (values, group, num, count, median);
+    else median_sketch (values, group, num, count, min, max, median);
+}
+
+
+static void median_sketch (const double values[], const int group[], int num,
+                           const int count[], const double min[], const double max[], double median[])
+{
+    const int num_buckets = k_median_buckets+1;     // bucket 0 takes zero and values too small for the others
+    const double gamma = (1.+k_median_accuracy)/(1.-k_median_accuracy);
+    const double log_gamma = log (gamma);
+    int *buckets, offset[k_max_residents+1];
+
+    // The uppermost bucket of a group contains its maximum
+    for (int g=0; g<=k_max_residents; g++)
+    {
+        offset[g] = max[g] > 0. ? k_median_buckets - (int)ceil (log (max[g])/log_gamma) : 0;
+    }
+    alloc_memory (&buckets, (k_max_residents+1)*num_buckets, "median_sketch");
+    for (int i=0; i<(k_max_residents+1)*num_buckets; i++) buckets[i] = 0;
+    for (int i=0; i<num; i++)
+    {
+        const int groups[2] = {0, group[i]};
+        const int key = values[i] > 0. ? (int)ceil (log (values[i])/log_gamma) : INT_MIN/2;
+        for (int j=0; j<2; j++)
+        {
+            int b = key + offset[groups[j]];
+            if (b < 1 || max[groups[j]] <= 0.) b = 0;
+            else if (b > k_median_buckets) b = k_median_buckets;
+            buckets[groups[j]*num_buckets + b]++;
+        }
+    }
+#ifdef PARALLEL
+    if (rank == 0)
+        MPI_Reduce (MPI_IN_PLACE, buckets, (k_max_residents+1)*num_buckets, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    else
+        MPI_Reduce (buckets, buckets, (k_max_residents+1)*num_buckets, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+    if (rank == 0)
+    {
+        for (int g=0; g<=k_max_residents; g++)
+        {
+            if (count[g] == 0) continue;
+            const int *bucket = buckets + g*num_buckets;
+            const int rank_1 = (count[g]-1)/2;     // the two middle values, which are the same
+            const int rank_2 = count[g]/2;         // one if the count is odd
+            double value[2];
+            int sum = 0, b = 0;
+            for (int j=0; j<2; j++)
+            {
+                while (sum + bucket[b] <= (j ? rank_2 : rank_1))
+                {
+                    sum += bucket[b];
+                    b++;
+                }
+                // A bucket is represented by the value with the same relative distance to both bounds
+                if (b == 0) value[j] = min[g];
+                else value[j] = 2.*pow (gamma, b - offset[g])/(gamma+1.);
+                if (value[j] < min[g]) value[j] = min[g];
+                if (value[j] > max[g]) value[j] = max[g];
+            }
+            median[g] = (value[0] + value[1])/2.;
+        }
+    }
+    delete [] buckets;
+}
+
+
+// Position of the first value in v[lo...hi-1] which is >= x (or > x, if 'upper' is set)
+
+static int bound (const double v[], int lo, int hi, double x, bool upper)
+{
+    while (lo < hi)
+    {
+        int mid = lo + (hi-lo)/2;
+        if (v[mid] < x || (upper && v[mid] == x)) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+
+// Select the k-th smallest value (k = 0, 1, ...) of the sorted arrays v of all
+// processes without collecting them. Every process proposes the middle value of
+// its remaining range, the pivot is the median of these proposals weighted with
+// the size of the ranges. At least a quarter of the remaining values is dropped
+// in each round.
+
+static double select_value (const double v[], int n, int k)
+{
+    int lo = 0, hi = n;
+
+    while (true)
+    {
+        double proposal[2], pivot;
+        int num_less[2];
+
+        proposal[0] = hi > lo ? v[lo + (hi-lo)/2] : 0.;
+        proposal[1] = hi - lo;
+#ifdef PARALLEL
+        double *proposals;
+        double weight_total = 0., weight = 0.;
+        alloc_memory (&proposals, 2*num_processes, "select_value");
+        MPI_Allgather (proposal, 2, MPI_DOUBLE, proposals, 2, MPI_DOUBLE, MPI_COMM_WORLD);
+        // Weighted median of the proposals: sorted by value, the first one at
+        // which the accumulated weight reaches half of the total weight
+        qsort (proposals, (size_t)num_processes, 2*sizeof(double), (int (*)(const void *, const void *))&compare_double);
+        for (int p=0; p<num_processes; p++) weight_total += proposals[2*p+1];
+        pivot = 0.;
+        for (int p=0; p<num_processes; p++)
+        {
+            if (proposals[2*p+1] == 0.) continue;
+            pivot = proposals[2*p];
+            weight += proposals[2*p+1];
+            if (2.*weight >= weight_total) break;
+        }
+        delete [] proposals;
+#else
+        pivot = proposal[0];
+#endif
+        const int less = bound (v, lo, hi, pivot, false);
+        const int less_or_equal = bound (v, less, hi, pivot, true);
+        num_less[0] = less - lo;
+        num_less[1] = less_or_equal - lo;
+#ifdef PARALLEL
+        MPI_Allreduce (MPI_IN_PLACE, num_less, 2, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#endif
+        if (k < num_less[0]) hi = less;
+        else if (k < num_less[1]) return pivot;
+        else
+        {
+            k -= num_less[1];
+            lo = less_or_equal;
+        }
+    }
+}
+
+
+static void median_exact (const double values[], const int group[], int num,
+                          const int count[], double median[])
+{
+    double *v;
+    int n;
+
+    alloc_memory (&v, num > 0 ? num : 1, "median_exact");
+    for (int g=0; g<=k_max_residents; g++)
+    {
+        if (count[g] == 0) continue;
+        n = 0;
+        for (int i=0; i<num; i++) if (g == 0 || group[i] == g) v[n++] = values[i];
+        qsort (v, (size_t)n, sizeof(double), (int (*)(const void *, const void *))&compare_double);
+        double value_1 = select_value (v, n, (count[g]-1)/2);
+        double value_2 = value_1;
+        if (count[g]%2 == 0)
+        {
+            // The next value is either equal to value_1 or the smallest value above it
+            int pos = bound (v, 0, n, value_1, true);
+            int num_not_above = pos;
+            double next = pos < n ? v[pos] : DBL_MAX;
+#ifdef PARALLEL
+            MPI_Allreduce (MPI_IN_PLACE, &num_not_above, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+            MPI_Allreduce (MPI_IN_PLACE, &next, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+#endif
+            if (num_not_above <= count[g]/2) value_2 = next;
+        }
+        median[g] = (value_1 + value_2)/2.;
+    }
+    delete [] v;
+}
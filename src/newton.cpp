@@ -0,0 +1,780 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "globals.H"
+#include "proto.H"
+#include "types.H"
+#include "powerflow.H"
+
+// A sparse Newton-Raphson solver for the AC power flow problem in polar
+// coordinates. The unknowns are the voltage angles of the PQ and PV buses and
+// the voltage magnitudes of the PQ buses. Each Newton step solves a linear system
+// with the Jacobian by means of a sparse LU factorization. The sparsity pattern
+// of the factors is determined only once: the buses are ordered by the minimum
+// degree heuristic, so that a radial distribution grid is factorized without
+// any fill-in. The voltages of the previous call are the starting point for the
+// next one.
+
+static const double k_nr_tolerance = 1e-8;    // max. power mismatch [p.u.]
+static const int    k_nr_max_iterations = 20;
+
+static void build_rows (int num_rows, int num_entries, const int row[], const int col[],
+                        int **start, int **col_out, int **index);
+static void minimum_degree_ordering (int n, const int start[], const int col[], int order[],
+                                     int **u_start, int **u_col);
+static bool invert_2x2 (const double a[4], double inv[4]);
+
+
+void Powerflow::init_newton()
+{
+    const char function_name[] = "Powerflow::init_newton";
+    int i, j, k, b, n = num_buses;
+
+    alloc_memory (&newton.type, n, function_name);
+    alloc_memory (&newton.row, n, function_name);
+    alloc_memory (&newton.v_mag, n, function_name);
+    alloc_memory (&newton.v_ang, n, function_name);
+    alloc_memory (&newton.p_spec, n, function_name);
+    alloc_memory (&newton.q_spec, n, function_name);
+    alloc_memory (&newton.p_calc, n, function_name);
+    alloc_memory (&newton.q_calc, n, function_name);
+
+    // Initial voltages from the case file. A PV bus remains a PV bus only if
+    // there is a generator in service, which holds the voltage.
+
+    for (i=0; i<n; i++)
+    {
+        newton.type[i] = bus[i].type == PV ? PQ : bus[i].type;
+        newton.v_mag[i] = bus[i].Vm;
+        newton.v_ang[i] = bus[i].Va * M_PI/180.;
+    }
+    for (j=0; j<num_generators; j++)
+    {
+        if (generator[j].status <= 0) continue;
+        b = generator[j].bus-1;
+        if (bus[b].type == PV || bus[b].type == REF)
+        {
+            newton.type[b] = bus[b].type;
+            newton.v_mag[b] = generator[j].Vg;
+        }
+    }
+    for (i=0; i<n && newton.type[i] != REF; i++);
+    if (i == n)
+    {
+        fprintf (stderr, "Powerflow: The case data doesn't contain a reference bus (bus type 3).\n");
+        exit (1);
+    }
+
+    // The bus admittance matrix. It's assembled from a list of entries (bus i, bus k),
+    // which may contain the same position several times (e.g. parallel branches).
+
+    int num_entries = n;
+    for (k=0; k<num_branches; k++) if (branch[k].status > 0) num_entries += 4;
+    int *e_row, *e_col, *index;
+    double *e_G, *e_B;
+    alloc_memory (&e_row, num_entries, function_name);
+    alloc_memory (&e_col, num_entries, function_name);
+    alloc_memory (&e_G, num_entries, function_name);
+    alloc_memory (&e_B, num_entries, function_name);
+    alloc_memory (&newton.y_branch, 8*num_branches, function_name);
+
+    for (i=0; i<n; i++)
+    {
+        e_row[i] = e_col[i] = i;
+        e_G[i] = bus[i].Gs / baseMVA;
+        e_B[i] = bus[i].Bs / baseMVA;
+    }
+    int e = n;
+    for (k=0; k<num_branches; k++)
+    {
+        double *y = newton.y_branch + 8*k;
+        for (j=0; j<8; j++) y[j] = 0.;
+        if (branch[k].status <= 0) continue;
+
+        double z2 = branch[k].r*branch[k].r + branch[k].x*branch[k].x;
+        if (z2 == 0.)
+        {
+            fprintf (stderr, "Powerflow: Branch %d-%d has zero impedance.\n", branch[k].from, branch[k].to);
+            exit (1);
+        }
+        double gs = branch[k].r/z2, bs = -branch[k].x/z2;         // series admittance
+        double tap = branch[k].ratio == 0. ? 1. : branch[k].ratio;
+        double shift = branch[k].angle * M_PI/180.;
+        double tr = tap*cos (shift), ti = tap*sin (shift);        // complex tap ratio t
+        // Ytt = ys + j b/2,  Yff = Ytt / |t|^2,  Yft = -ys / conj(t),  Ytf = -ys / t
+        y[6] = gs;
+        y[7] = bs + 0.5*branch[k].b;
+        y[0] = y[6] / (tap*tap);
+        y[1] = y[7] / (tap*tap);
+        y[2] = -(gs*tr - bs*ti) / (tap*tap);
+        y[3] = -(bs*tr + gs*ti) / (tap*tap);
+        y[4] = -(gs*tr + bs*ti) / (tap*tap);
+        y[5] = -(bs*tr - gs*ti) / (tap*tap);
+
+        int f = branch[k].from-1, t = branch[k].to-1;
+        e_row[e] = f; e_col[e] = f; e_G[e] = y[0]; e_B[e] = y[1]; e++;
+        e_row[e] = f; e_col[e] = t; e_G[e] = y[2]; e_B[e] = y[3]; e++;
+        e_row[e] = t; e_col[e] = f; e_G[e] = y[4]; e_B[e] = y[5]; e++;
+        e_row[e] = t; e_col[e] = t; e_G[e] = y[6]; e_B[e] = y[7]; e++;
+    }
+    build_rows (n, num_entries, e_row, e_col, &newton.y_start, &newton.y_col, &index);
+    alloc_memory (&newton.y_G, newton.y_start[n], function_name);
+    alloc_memory (&newton.y_B, newton.y_start[n], function_name);
+    for (i=0; i<newton.y_start[n]; i++) newton.y_G[i] = newton.y_B[i] = 0.;
+    for (e=0; e<num_entries; e++)
+    {
+        newton.y_G[index[e]] += e_G[e];
+        newton.y_B[index[e]] += e_B[e];
+    }
+    delete [] index;
+    delete [] e_row;
+    delete [] e_col;
+    delete [] e_G;
+    delete [] e_B;
+
+    // The graph of the PQ and PV buses is ordered such that the LU factorization
+    // creates as little fill-in as possible
+
+    int m = 0;
+    int *unknown;
+    alloc_memory (&unknown, n, function_name);
+    for (i=0; i<n; i++)
+    {
+        if (newton.type[i] == PQ || newton.type[i] == PV) unknown[i] = m++;
+        else unknown[i] = -1;
+    }
+    newton.num_unknown = m;
+    int *g_start, *g_col, *g_row, *u_start, *u_col, *order;
+    num_entries = 0;
+    for (i=0; i<n; i++)
+        for (j=newton.y_start[i]; j<newton.y_start[i+1]; j++)
+            if (unknown[i] >= 0 && unknown[newton.y_col[j]] >= 0 && newton.y_col[j] != i) num_entries++;
+    alloc_memory (&g_row, num_entries+1, function_name);
+    alloc_memory (&g_col, num_entries+1, function_name);
+    num_entries = 0;
+    for (i=0; i<n; i++)
+        for (j=newton.y_start[i]; j<newton.y_start[i+1]; j++)
+            if (unknown[i] >= 0 && unknown[newton.y_col[j]] >= 0 && newton.y_col[j] != i)
+            {
+                g_row[num_entries] = unknown[i];
+                g_col[num_entries++] = unknown[newton.y_col[j]];
+            }
+    build_rows (m, num_entries, g_row, g_col, &g_start, &u_col, &index);
+    delete [] index;
+    delete [] g_row;
+    delete [] g_col;
+    g_col = u_col;
+    alloc_memory (&order, m, function_name);
+    minimum_degree_ordering (m, g_start, g_col, order, &u_start, &u_col);
+    delete [] g_start;
+    delete [] g_col;
+
+    alloc_memory (&newton.bus_of_row, m, function_name);
+    int *bus_of_unknown;
+    alloc_memory (&bus_of_unknown, m, function_name);
+    for (i=0; i<n; i++)
+    {
+        newton.row[i] = -1;
+        if (unknown[i] >= 0) bus_of_unknown[unknown[i]] = i;
+    }
+    for (i=0; i<m; i++)
+    {
+        newton.bus_of_row[i] = bus_of_unknown[order[i]];
+        newton.row[newton.bus_of_row[i]] = i;
+    }
+    delete [] bus_of_unknown;
+    delete [] unknown;
+
+    // Block pattern of the LU factors: row r contains the diagonal, the rows
+    // eliminated later (U) and the rows eliminated earlier (L = transposed U)
+
+    num_entries = m;
+    for (i=0; i<m; i++) num_entries += 2*(u_start[i+1]-u_start[i]);
+    alloc_memory (&g_row, num_entries+1, function_name);
+    alloc_memory (&g_col, num_entries+1, function_name);
+    e = 0;
+    for (i=0; i<m; i++)
+    {
+        g_row[e] = i; g_col[e++] = i;
+        for (j=u_start[i]; j<u_start[i+1]; j++)
+        {
+            g_row[e] = i; g_col[e++] = u_col[j];
+            g_row[e] = u_col[j]; g_col[e++] = i;
+        }
+    }
+    build_rows (m, num_entries, g_row, g_col, &newton.j_start, &newton.j_col, &index);
+    delete [] index;
+    delete [] g_row;
+    delete [] g_col;
+    delete [] u_start;
+    delete [] u_col;
+    delete [] order;
+
+    alloc_memory (&newton.j_diag, m+1, function_name);
+    for (i=0; i<m; i++)
+    {
+        for (j=newton.j_start[i]; newton.j_col[j] != i; j++);
+        newton.j_diag[i] = j;
+    }
+    int nnz = newton.j_start[m];
+    alloc_memory (&newton.j_val, 4*nnz+1, function_name);
+    alloc_memory (&newton.d_inv, 4*m+1, function_name);
+    alloc_memory (&newton.work, 4*m+1, function_name);
+    alloc_memory (&newton.rhs, 2*m+1, function_name);
+    for (i=0; i<4*m; i++) newton.work[i] = 0.;
+
+    // Where does an entry of Y go in the Jacobian?
+
+    alloc_memory (&newton.y_to_j, newton.y_start[n], function_name);
+    for (i=0; i<n; i++)
+    {
+        for (j=newton.y_start[i]; j<newton.y_start[i+1]; j++)
+        {
+            newton.y_to_j[j] = -1;
+            int r = newton.row[i], c = newton.row[newton.y_col[j]];
+            if (r < 0 || c < 0) continue;
+            for (k=newton.j_start[r]; k<newton.j_start[r+1]; k++)
+            {
+                if (newton.j_col[k] == c)
+                {
+                    newton.y_to_j[j] = k;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+void Powerflow::delete_newton()
+{
+    delete [] newton.type;
+    delete [] newton.row;
+    delete [] newton.bus_of_row;
+    delete [] newton.y_start;
+    delete [] newton.y_col;
+    delete [] newton.y_G;
+    delete [] newton.y_B;
+    delete [] newton.y_to_j;
+    delete [] newton.y_branch;
+    delete [] newton.j_start;
+    delete [] newton.j_col;
+    delete [] newton.j_diag;
+    delete [] newton.j_val;
+    delete [] newton.d_inv;
+    delete [] newton.work;
+    delete [] newton.rhs;
+    delete [] newton.v_mag;
+    delete [] newton.v_ang;
+    delete [] newton.p_spec;
+    delete [] newton.q_spec;
+    delete [] newton.p_calc;
+    delete [] newton.q_calc;
+}
+
+
+// The specified net injections are the generation minus the load
+// at each bus, which has been set in update_loads().
+
+void Powerflow::update_injections()
+{
+    for (int i=0; i<num_buses; i++)
+    {
+        newton.p_spec[i] = -bus[i].Pd / baseMVA;
+        newton.q_spec[i] = -bus[i].Qd / baseMVA;
+    }
+    for (int j=0; j<num_generators; j++)
+    {
+        if (generator[j].status <= 0) continue;
+        newton.p_spec[generator[j].bus-1] += generator[j].Pg / baseMVA;
+        newton.q_spec[generator[j].bus-1] += generator[j].Qg / baseMVA;
+    }
+}
+
+
+bool Powerflow::solve_newton()
+{
+    const int m = newton.num_unknown;
+    const int *y_start = newton.y_start, *y_col = newton.y_col;
+    const double *G = newton.y_G, *B = newton.y_B;
+    double *V = newton.v_mag, *theta = newton.v_ang;
+    double *P = newton.p_calc, *Q = newton.q_calc;
+    int i, k, r, c, iteration;
+
+    update_injections();
+
+    for (iteration=0; ; iteration++)
+    {
+        // Power injections of the current voltages and the mismatch
+
+        calc_injections();
+        double mismatch = 0.;
+        for (i=0; i<num_buses; i++)
+        {
+            r = newton.row[i];
+            if (r < 0) continue;
+            newton.rhs[2*r] = newton.p_spec[i] - P[i];
+            newton.rhs[2*r+1] = newton.type[i] == PQ ? newton.q_spec[i] - Q[i] : 0.;
+            for (k=2*r; k<2*r+2; k++)
+            {
+                double e = fabs (newton.rhs[k]);
+                if (e > mismatch || e != e) mismatch = e;  // a NaN sticks
+            }
+        }
+        if (mismatch < k_nr_tolerance) return true;
+        if (iteration == k_nr_max_iterations || mismatch != mismatch) return false;
+
+        // The Jacobian. Each block contains the derivatives of P and Q
+        // with respect to the angle and the magnitude:
+        //   | dP/dtheta  dP/dV |
+        //   | dQ/dtheta  dQ/dV |
+        // At PV buses the magnitude is fixed, so the Q row and the V column
+        // are replaced by the identity.
+
+        for (k=0; k<4*newton.j_start[m]; k++) newton.j_val[k] = 0.;
+        for (i=0; i<num_buses; i++)
+        {
+            if (newton.row[i] < 0) continue;
+            for (k=y_start[i]; k<y_start[i+1]; k++)
+            {
+                if (newton.y_to_j[k] < 0) continue;
+                double *a = newton.j_val + 4*newton.y_to_j[k];
+                int b = y_col[k];
+                if (b == i)
+                {
+                    a[0] += -Q[i] - B[k]*V[i]*V[i];
+                    a[1] += P[i]/V[i] + G[k]*V[i];
+                    a[2] += P[i] - G[k]*V[i]*V[i];
+                    a[3] += Q[i]/V[i] - B[k]*V[i];
+                }
+                else
+                {
+                    double d = theta[i] - theta[b];
+                    double cs = cos (d), sn = sin (d);
+                    a[0] += V[i]*V[b] * (G[k]*sn - B[k]*cs);
+                    a[1] += V[i] * (G[k]*cs + B[k]*sn);
+                    a[2] += -V[i]*V[b] * (G[k]*cs + B[k]*sn);
+                    a[3] += V[i] * (G[k]*sn - B[k]*cs);
+                }
+                if (newton.type[i] == PV)
+                {
+                    a[2] = 0.;
+                    a[3] = b == i ? 1. : 0.;
+                }
+                if (newton.type[b] == PV)
+                {
+                    a[1] = 0.;
+                    if (b != i) a[3] = 0.;
+                    else if (newton.type[i] == PV) a[3] = 1.;
+                }
+            }
+        }
+
+        // LU factorization (row by row, L has unit diagonal blocks)
+
+        double *w = newton.work, *val = newton.j_val;
+        const int *j_start = newton.j_start, *j_col = newton.j_col;
+        for (r=0; r<m; r++)
+        {
+            for (k=j_start[r]; k<j_start[r+1]; k++)
+            {
+                c = j_col[k];
+                for (int l=0; l<4; l++) w[4*c+l] = val[4*k+l];
+            }
+            for (k=j_start[r]; k<newton.j_diag[r]; k++)
+            {
+                c = j_col[k];
+                double *x = w + 4*c, *d = newton.d_inv + 4*c, t[4];
+                // L(r,c) = W(r,c) * inv(U(c,c))
+                t[0] = x[0]*d[0] + x[1]*d[2];
+                t[1] = x[0]*d[1] + x[1]*d[3];
+                t[2] = x[2]*d[0] + x[3]*d[2];
+                t[3] = x[2]*d[1] + x[3]*d[3];
+                for (int l=0; l<4; l++) x[l] = t[l];
+                // W(r,j) -= L(r,c) * U(c,j)
+                for (int l=newton.j_diag[c]+1; l<j_start[c+1]; l++)
+                {
+                    double *y = w + 4*j_col[l], *u = val + 4*l;
+                    y[0] -= t[0]*u[0] + t[1]*u[2];
+                    y[1] -= t[0]*u[1] + t[1]*u[3];
+                    y[2] -= t[2]*u[0] + t[3]*u[2];
+                    y[3] -= t[2]*u[1] + t[3]*u[3];
+                }
+            }
+            for (k=j_start[r]; k<j_start[r+1]; k++)
+            {
+                c = j_col[k];
+                for (int l=0; l<4; l++)
+                {
+                    val[4*k+l] = w[4*c+l];
+                    w[4*c+l] = 0.;
+                }
+            }
+            if (!invert_2x2 (val + 4*newton.j_diag[r], newton.d_inv + 4*r)) return false;
+        }
+
+        // Forward and backward substitution
+
+        double *x = newton.rhs;
+        for (r=0; r<m; r++)
+        {
+            for (k=j_start[r]; k<newton.j_diag[r]; k++)
+            {
+                c = j_col[k];
+                x[2*r]   -= val[4*k]*x[2*c]   + val[4*k+1]*x[2*c+1];
+                x[2*r+1] -= val[4*k+2]*x[2*c] + val[4*k+3]*x[2*c+1];
+            }
+        }
+        for (r=m-1; r>=0; r--)
+        {
+            for (k=newton.j_diag[r]+1; k<j_start[r+1]; k++)
+            {
+                c = j_col[k];
+                x[2*r]   -= val[4*k]*x[2*c]   + val[4*k+1]*x[2*c+1];
+                x[2*r+1] -= val[4*k+2]*x[2*c] + val[4*k+3]*x[2*c+1];
+            }
+            double *d = newton.d_inv + 4*r;
+            double x0 = x[2*r], x1 = x[2*r+1];
+            x[2*r]   = d[0]*x0 + d[1]*x1;
+            x[2*r+1] = d[2]*x0 + d[3]*x1;
+        }
+
+        // Update the voltages
+
+        for (r=0; r<m; r++)
+        {
+            i = newton.bus_of_row[r];
+            theta[i] += x[2*r];
+            if (newton.type[i] == PQ) V[i] += x[2*r+1];
+        }
+    }
+}
+
+
+// Power injected into the grid at each bus by the current voltages
+
+void Powerflow::calc_injections()
+{
+    const double *G = newton.y_G, *B = newton.y_B;
+    const double *V = newton.v_mag, *theta = newton.v_ang;
+    double *P = newton.p_calc, *Q = newton.q_calc;
+
+    for (int i=0; i<num_buses; i++)
+    {
+        P[i] = Q[i] = 0.;
+        for (int k=newton.y_start[i]; k<newton.y_start[i+1]; k++)
+        {
+            int b = newton.y_col[k];
+            double d = theta[i] - theta[b];
+            double cs = cos (d), sn = sin (d);
+            P[i] += V[b] * (G[k]*cs + B[k]*sn);
+            Q[i] += V[b] * (G[k]*sn - B[k]*cs);
+        }
+        P[i] *= V[i];
+        Q[i] *= V[i];
+    }
+}
+
+
+void Powerflow::calc_branch_flows()
+{
+    const double *V = newton.v_mag, *theta = newton.v_ang;
+
+    for (int k=0; k<num_branches; k++)
+    {
+        const double *y = newton.y_branch + 8*k;
+        int f = branch[k].from-1, t = branch[k].to-1;
+        double vf_re = V[f]*cos (theta[f]), vf_im = V[f]*sin (theta[f]);
+        double vt_re = V[t]*cos (theta[t]), vt_im = V[t]*sin (theta[t]);
+        // If = Yff Vf + Yft Vt,  It = Ytf Vf + Ytt Vt,  S = V conj(I)
+        double if_re = y[0]*vf_re - y[1]*vf_im + y[2]*vt_re - y[3]*vt_im;
+        double if_im = y[0]*vf_im + y[1]*vf_re + y[2]*vt_im + y[3]*vt_re;
+        double it_re = y[4]*vf_re - y[5]*vf_im + y[6]*vt_re - y[7]*vt_im;
+        double it_im = y[4]*vf_im + y[5]*vf_re + y[6]*vt_im + y[7]*vt_re;
+        power_from[k] = (vf_re*if_re + vf_im*if_im) * baseMVA;
+        power_to[k] = (vt_re*it_re + vt_im*it_im) * baseMVA;
+    }
+}
+
+
+// Write the results in a human readable form. The file is only needed
+// if the in- and output of the power flow calculations is to be kept.
+
+void Powerflow::write_results_file()
+{
+    FILE *fp = NULL;
+    open_file (&fp, "results", "w");
+    fprintf (fp, "Bus data\n");
+    fprintf (fp, "%8s %12s %12s %12s %12s\n", "bus", "Vm (p.u.)", "Va (deg)", "P (MW)", "Q (MVAr)");
+    for (int i=0; i<num_buses; i++)
+    {
+        fprintf (fp, "%8d %12.6lf %12.6lf %12.6lf %12.6lf\n", bus[i].nr, newton.v_mag[i], newton.v_ang[i]*180./M_PI,
+                 newton.p_calc[i]*baseMVA, newton.q_calc[i]*baseMVA);
+    }
+    fprintf (fp, "Line data\n");
+    fprintf (fp, "%8s %8s %12s %12s %12s %8s\n", "from", "to", "Pf (MW)", "Pt (MW)", "loss (MW)", "status");
+    for (int k=0; k<num_branches; k++)
+    {
+        fprintf (fp, "%8d %8d %12.6lf %12.6lf %12.6lf %8d\n", branch[k].from, branch[k].to,
+                 power_from[k], power_to[k], power_from[k]+power_to[k], branch[k].status);
+    }
+    fclose (fp);
+}
+
+
+// Build a compressed row structure from a list of (row, col) pairs. The
+// columns of each row are sorted and duplicates are merged. index[e] is the
+// position of pair e in the new structure.
+
+static void build_rows (int num_rows, int num_entries, const int row[], const int col[],
+                        int **start, int **col_out, int **index)
+{
+    const char function_name[] = "build_rows";
+    int i, j, k, e;
+    int *s, *c, *order;
+
+    alloc_memory (&s, num_rows+1, function_name);
+    alloc_memory (&order, num_entries+1, function_name);
+    alloc_memory (index, num_entries+1, function_name);
+    for (i=0; i<=num_rows; i++) s[i] = 0;
+    for (e=0; e<num_entries; e++) s[row[e]+1]++;
+    for (i=0; i<num_rows; i++) s[i+1] += s[i];
+    for (e=0; e<num_entries; e++) order[s[row[e]]++] = e;
+    for (i=num_rows; i>0; i--) s[i] = s[i-1];
+    s[0] = 0;
+
+    // sort each row by column (insertion sort, the rows are short)
+    for (i=0; i<num_rows; i++)
+    {
+        for (j=s[i]+1; j<s[i+1]; j++)
+        {
+            int tmp = order[j];
+            for (k=j; k>s[i] && col[order[k-1]] > col[tmp]; k--) order[k] = order[k-1];
+            order[k] = tmp;
+        }
+    }
+    alloc_memory (&c, num_entries+1, function_name);
+    int pos = 0;
+    for (i=0; i<num_rows; i++)
+    {
+        int first = pos;
+        for (j=s[i]; j<s[i+1]; j++)
+        {
+            e = order[j];
+            if (pos == first || c[pos-1] != col[e]) c[pos++] = col[e];
+            (*index)[e] = pos-1;
+        }
+        s[i] = first;
+    }
+    s[num_rows] = pos;
+    delete [] order;
+    *start = s;
+    *col_out = c;
+}
+
+
+// Minimum degree ordering of a symmetric graph (without self loops).
+// The elimination is carried out on the graph explicitly. The neighbours a node
+// has when it is eliminated are returned in (u_start, u_col), numbered by
+// elimination order: this is the pattern of the U factor.
+
+static void minimum_degree_ordering (int n, const int start[], const int col[], int order[],
+                                     int **u_start, int **u_col)
+{
+    const char function_name[] = "minimum_degree_ordering";
+    int i, j, k, p;
+    int **adj, *len, *cap, *mark, *position;
+    int *heap_node, *heap_deg, heap_size = 0, heap_cap;
+
+    alloc_memory (&adj, n+1, function_name);
+    alloc_memory (&len, n+1, function_name);
+    alloc_memory (&cap, n+1, function_name);
+    alloc_memory (&mark, n+1, function_name);
+    alloc_memory (&position, n+1, function_name);
+    for (i=0; i<n; i++)
+    {
+        len[i] = start[i+1] - start[i];
+        cap[i] = len[i] + 4;
+        alloc_memory (adj+i, cap[i], function_name);
+        for (j=0; j<len[i]; j++) adj[i][j] = col[start[i]+j];
+        mark[i] = -1;
+        position[i] = -1;
+    }
+
+    // A binary heap of (degree, node) with lazy deletion of outdated entries
+    heap_cap = 4*n + 16;
+    alloc_memory (&heap_node, heap_cap, function_name);
+    alloc_memory (&heap_deg, heap_cap, function_name);
+#define HEAP_LESS(a,b) (heap_deg[a] < heap_deg[b] || (heap_deg[a] == heap_deg[b] && heap_node[a] < heap_node[b]))
+#define HEAP_SWAP(a,b) { int t_ = heap_node[a]; heap_node[a] = heap_node[b]; heap_node[b] = t_; \
+                         t_ = heap_deg[a]; heap_deg[a] = heap_deg[b]; heap_deg[b] = t_; }
+    for (i=0; i<n; i++)
+    {
+        heap_node[heap_size] = i;
+        heap_deg[heap_size] = len[i];
+        for (k=heap_size++; k>0 && HEAP_LESS(k, (k-1)/2); k=(k-1)/2) HEAP_SWAP(k, (k-1)/2);
+    }
+
+    int num_u = 0, u_cap = 4*n + 16;
+    int *u_node;
+    alloc_memory (u_start, n+1, function_name);
+    alloc_memory (&u_node, u_cap, function_name);
+
+    for (int step=0; step<n; step++)
+    {
+        // Pop the node with minimum degree
+        do
+        {
+            p = heap_node[0];
+            int d = heap_deg[0];
+            heap_size--;
+            heap_node[0] = heap_node[heap_size];
+            heap_deg[0] = heap_deg[heap_size];
+            for (k=0; ; )
+            {
+                int l = 2*k+1, r = 2*k+2, s = k;
+                if (l < heap_size && HEAP_LESS(l, s)) s = l;
+                if (r < heap_size && HEAP_LESS(r, s)) s = r;
+                if (s == k) break;
+                HEAP_SWAP(k, s);
+                k = s;
+            }
+            if (position[p] < 0 && d == len[p]) break;
+        } while (true);
+
+        position[p] = step;
+        order[step] = p;
+        (*u_start)[step] = num_u;
+        if (num_u + len[p] > u_cap)
+        {
+            int *tmp;
+            u_cap = 2*(num_u + len[p]);
+            alloc_memory (&tmp, u_cap, function_name);
+            for (k=0; k<num_u; k++) tmp[k] = u_node[k];
+            delete [] u_node;
+            u_node = tmp;
+        }
+        for (j=0; j<len[p]; j++) u_node[num_u++] = adj[p][j];
+
+        // Remove p from its neighbours and connect the neighbours with each other
+        for (j=0; j<len[p]; j++)
+        {
+            int a = adj[p][j];
+            for (k=0; k<len[a]; k++)
+            {
+                if (adj[a][k] == p) adj[a][k] = adj[a][--len[a]];
+            }
+            for (k=0; k<len[a]; k++) mark[adj[a][k]] = a;
+            for (k=0; k<len[p]; k++)
+            {
+                int b = adj[p][k];
+                if (b == a || mark[b] == a) continue;
+                if (len[a] == cap[a])
+                {
+                    int *tmp;
+                    cap[a] *= 2;
+                    alloc_memory (&tmp, cap[a], function_name);
+                    for (i=0; i<len[a]; i++) tmp[i] = adj[a][i];
+                    delete [] adj[a];
+                    adj[a] = tmp;
+                }
+                adj[a][len[a]++] = b;
+                mark[b] = a;
+            }
+            if (heap_size == heap_cap)
+            {
+                int *tmp_node, *tmp_deg;
+                heap_cap *= 2;
+                alloc_memory (&tmp_node, heap_cap, function_name);
+                alloc_memory (&tmp_deg, heap_cap, function_name);
+                for (i=0; i<heap_size; i++)
+                {
+                    tmp_node[i] = heap_node[i];
+                    tmp_deg[i] = heap_deg[i];
+                }
+                delete [] heap_node;
+                delete [] heap_deg;
+                heap_node = tmp_node;
+                heap_deg = tmp_deg;
+            }
+            heap_node[heap_size] = a;
+            heap_deg[heap_size] = len[a];
+            for (k=heap_size++; k>0 && HEAP_LESS(k, (k-1)/2); k=(k-1)/2) HEAP_SWAP(k, (k-1)/2);
+        }
+        len[p] = 0;
+    }
+#undef HEAP_LESS
+#undef HEAP_SWAP
+    (*u_start)[n] = num_u;
+
+    // Renumber the U pattern by elimination order
+    alloc_memory (u_col, num_u+1, function_name);
+    for (k=0; k<num_u; k++) (*u_col)[k] = position[u_node[k]];
+
+    for (i=0; i<n; i++) delete [] adj[i];
+    delete [] adj;
+    delete [] len;
+    delete [] cap;
+    delete [] mark;
+    delete [] position;
+    delete [] heap_node;
+    delete [] heap_deg;
+    delete [] u_node;
+}
+
+
+static bool invert_2x2 (const double a[4], double inv[4])
+{
+    double det = a[0]*a[3] - a[1]*a[2];
+    if (det == 0. || det != det) return false;
+    inv[0] =  a[3]/det;
+    inv[1] = -a[1]/det;
+    inv[2] = -a[2]/det;
+    inv[3] =  a[0]/det;
+    return true;
+}
@@ -44,6 +44,7 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
+#include <math.h>
 #include <typeinfo>
 #ifdef _WIN32
 #   include <io.h>
@@ -65,6 +66,7 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "heatstorage.H"
 #include "proto.H"
 #include "output.H"
+#include "profiler.H"
 #include "globals.H"
 #include "types.H"
 
@@ -80,9 +82,24 @@ Output::Output()
         file_ptr[i] = NULL;
         power[i] = NULL;
         value_ptr_2[i] = NULL;
+        column_2[i] = NULL;
+        real_index[i] = -1;
     }
     battery_file = NULL;
     gridbalance_file = NULL;
+    send_buffer = NULL;
+    recv_buffer = NULL;
+    buffer_size = 0;
+    pending = false;
+    resume = false;
+    resume_num_files = 0;
+}
+
+
+Output::~Output()
+{
+    delete [] send_buffer;
+    delete [] recv_buffer;
 }
 
 
@@ -100,7 +117,7 @@ void Output::open_files()
     if (Dishwasher::global_count())      add ("Dishwasher", Dishwasher::power_total, NULL);
     if (WashingMachine::global_count())  add ("Washing-Machine", WashingMachine::power_total, NULL);
     if (Freezer::global_count())         add ("Freezer", Freezer::power_total, NULL);
-    if (E_Vehicle::global_count())       add ("E-Vehicle", E_Vehicle::power_total, &E_Vehicle::arr_counter);
+    if (E_Vehicle::global_count())       add ("E-Vehicle", E_Vehicle::power_total, &E_Vehicle::arr_counter, "arrivals");
     if (AirConditioner::global_count())  add ("Air-Conditioner", AirConditioner::power_total, NULL);
     if (Vacuum::global_count())          add ("Vacuum", Vacuum::power_total, NULL);
     if (Heating::global_count())         add ("E-Heating", Heating::power_total, NULL);
@@ -108,9 +125,9 @@ void Output::open_files()
     if (SolarCollector::count)           add ("Solar-Collector", SolarCollector::power_total, NULL);
     if (SolarModule::count)
     {
-        add ("Solar-Module.real",     SolarModule::real_power_total, &Household::production_used_total);
+        add ("Solar-Module.real",     SolarModule::real_power_total, &Household::production_used_total, "used");
         add ("Solar-Module.reactive", SolarModule::reactive_power_total, NULL);
-        add ("Solar-Module.apparent", SolarModule::apparent_power_total, NULL);
+        add_apparent ("Solar-Module.apparent");
     }
     if (Battery::count)
     {
@@ -120,14 +137,14 @@ void Output::open_files()
                      &Battery::loss_charging_total,
                      &Battery::loss_discharging_total);
     }
-    if (HeatStorage::count) add ("Heat-Storage", HeatStorage::power_total, &HeatStorage::stored_heat_total);
+    if (HeatStorage::count) add ("Heat-Storage", HeatStorage::power_total, &HeatStorage::stored_heat_total, "stored_heat");
     add_gridbalance (&Household::power_from_grid_total,
                      &Household::power_to_grid_total,
                      &Household::power_above_limit_total,
                      &Battery::power_from_grid_total);
     add ("Household.real", Household::real_power_total, NULL);
     add ("Household.reactive", Household::reactive_power_total, NULL);
-    add ("Household.apparent", Household::apparent_power_total, NULL);
+    add_apparent ("Household.apparent");
     add ("Hot-Water-Demand", Household::power_hot_water, NULL);
     if (HeatSource::global_count(OIL))
     {
@@ -144,37 +161,89 @@ void Output::open_files()
         add ("District-Heating", HeatSource::heat_power_SH_total[DISTRICT], NULL);
         add ("District-Hot-Water", HeatSource::heat_power_DHW_total[DISTRICT], NULL);
     }
+    if (resume && num_files != resume_num_files)
+    {
+        fprintf (stderr, "The output files don't match the checkpoint.\n");
+        exit (1);
+    }
+    resume = false;  // the files of the following years start from scratch
 }
 
 
-void Output::add (const char *classname, double *ptr_1, double *ptr_2)
+void Output::add (const char *classname, double *ptr_1, double *ptr_2, const char *name_2)
 {
-    char file_name[k_max_path];
-
     if (num_files == k_max_files)
     {
         fprintf (stderr, "Cannot open more than %d files. Increase k_max_files.\n", num_files);
         exit (1);
     }
     strncpy (names[num_files], classname, k_name_length);
-    snprintf (file_name, sizeof(file_name), "power.%d.%s", sim_clock->year, classname);
-    if (rank == 0) open_file (file_ptr+num_files, file_name, "w");
     power[num_files] = ptr_1;
     value_ptr_2[num_files] = ptr_2;
+    column_2[num_files] = name_2 ? name_2 : "value_2";
+    if (rank == 0) open_power_file (num_files);
     num_files++;
 }
 
 
-void Output::add_battery (double *ptr_1, double *ptr_2, double *ptr_3,
-                          double *ptr_4, double *ptr_5)
+// The power files contain the time, the total power and the power of the
+// households with 1 ... k_max_residents persons (and optionally one more value).
+
+void Output::open_power_file (int i)
 {
     char file_name[k_max_path];
+    const char *columns[k_max_residents+3] = {"time", "total", "1", "2", "3", "4", "5", "6"};
+    int num_columns = k_max_residents+2;
+
+    if (value_ptr_2[i]) columns[num_columns++] = column_2[i];
+    snprintf (file_name, sizeof(file_name), "power.%d.%s", sim_clock->year, names[i]);
+    if (resume) reopen_series_file (file_ptr+i, file_name, resume_size[i]);
+    else open_series_file (file_ptr+i, file_name, num_columns, columns,
+                           sim_clock->year, JANUARY, 1, 0., config->timestep_size);
+}
 
-    if (rank == 0)
-    {
-        snprintf (file_name, sizeof(file_name), "battery.%d", sim_clock->year);
-        open_file (&battery_file, file_name, "w");
-    }
+
+void Output::open_battery_file()
+{
+    char file_name[k_max_path];
+    const char *columns[] = {"time", "charge", "power_charging", "power_discharging",
+                             "loss_charging", "loss_discharging"};
+
+    snprintf (file_name, sizeof(file_name), "battery.%d", sim_clock->year);
+    if (resume) reopen_series_file (&battery_file, file_name, resume_size[k_max_files]);
+    else open_series_file (&battery_file, file_name, 6, columns,
+                           sim_clock->year, JANUARY, 1, 0., config->timestep_size);
+}
+
+
+void Output::open_gridbalance_file()
+{
+    char file_name[k_max_path];
+    const char *columns[] = {"time", "balance", "from_grid", "to_grid",
+                             "above_limit", "battery_from_grid"};
+
+    snprintf (file_name, sizeof(file_name), "gridbalance.%d", sim_clock->year);
+    if (resume) reopen_series_file (&gridbalance_file, file_name, resume_size[k_max_files+1]);
+    else open_series_file (&gridbalance_file, file_name, 6, columns,
+                           sim_clock->year, JANUARY, 1, 0., config->timestep_size);
+}
+
+
+// The apparent power is not summed up over the households (or processes),
+// it's calculated from the total real and reactive power, which must have
+// been added right before.
+
+void Output::add_apparent (const char *classname)
+{
+    add (classname, NULL, NULL);
+    real_index[num_files-1] = num_files-3;
+}
+
+
+void Output::add_battery (double *ptr_1, double *ptr_2, double *ptr_3,
+                          double *ptr_4, double *ptr_5)
+{
+    if (rank == 0) open_battery_file();
     charge_total = ptr_1;
     power_charging_total = ptr_2;
     power_discharging_total = ptr_3;
@@ -185,13 +254,7 @@ void Output::add_battery (double *ptr_1, double *ptr_2, double *ptr_3,
 
 void Output::add_gridbalance (double *ptr_1, double *ptr_2, double *ptr_3, double *ptr_4)
 {
-    char file_name[k_max_path];
-
-    if (rank == 0)
-    {
-        snprintf (file_name, sizeof(file_name), "gridbalance.%d", sim_clock->year);
-        open_file (&gridbalance_file, file_name, "w");
-    }
+    if (rank == 0) open_gridbalance_file();
     power_from_grid_total = ptr_1;
     power_to_grid_total = ptr_2;
     power_above_limit_total = ptr_3;
@@ -203,7 +266,7 @@ void Output::reset()
 {
     for (int i=0; i<num_files; i++)
     {
-        for (int j=0; j<=k_max_residents; j++) power[i][j] = 0.;
+        if (power[i]) for (int j=0; j<=k_max_residents; j++) power[i][j] = 0.;
         if (value_ptr_2[i]) *value_ptr_2[i] = 0.;
     }
     *power_from_grid_total = 0.;
@@ -218,29 +281,32 @@ void Output::reset()
         *loss_discharging_total = 0.;
         *battery_from_grid_total = 0.;
     }
+    if (   sim_clock->midnight
+        && sim_clock->day == 1
+        && sim_clock->month == JANUARY)
+    {
+        flush();  // the last values of the old year still belong to the old files
+    }
     if (   sim_clock->midnight
         && sim_clock->day == 1
         && sim_clock->month == JANUARY
         && rank == 0)
     {
-        char file_name[k_max_path];
+        // The old files are closed by the writer once their last rows are written
         for (int i=0; i<num_files; i++)
         {
-            fclose (file_ptr[i]);
-            snprintf (file_name, sizeof(file_name), "power.%d.%s", sim_clock->year, names[i]);
-            open_file (file_ptr+i, file_name, "w");
+            writer->close (file_ptr[i]);
+            open_power_file (i);
         }
         if (battery_file)
         {
-            fclose (battery_file);
-            snprintf (file_name, sizeof(file_name), "battery.%d", sim_clock->year);
-            open_file (&battery_file, file_name, "w");
+            writer->close (battery_file);
+            open_battery_file();
         }
         if (gridbalance_file)
         {
-            fclose (gridbalance_file);
-            snprintf (file_name, sizeof(file_name), "gridbalance.%d", sim_clock->year);
-            open_file (&gridbalance_file, file_name, "w");
+            writer->close (gridbalance_file);
+            open_gridbalance_file();
         }
     }
 }
@@ -248,107 +314,207 @@ void Output::reset()
 
 void Output::close_files()
 {
+    flush();
     if (rank == 0)
     {
-        for (int i=0; i<num_files; i++) fclose (file_ptr[i]);
-        if (battery_file) fclose (battery_file);
-        if (gridbalance_file) fclose (gridbalance_file);
+        for (int i=0; i<num_files; i++) writer->close (file_ptr[i]);
+        if (battery_file) writer->close (battery_file);
+        if (gridbalance_file) writer->close (gridbalance_file);
     }
 }
 
 
-void Output::print_power()
+// Copy all values to be printed for the current timestep into the send buffer.
+// The layout of the buffer is given by the files registered in open_files().
+
+void Output::pack()
 {
+    int pos = 0;
+
+    if (send_buffer == NULL)
+    {
+        buffer_size = 0;
+        for (int i=0; i<num_files; i++)
+        {
+            if (power[i]) buffer_size += k_max_residents+1;
+            if (value_ptr_2[i]) buffer_size++;
+        }
+        if (Battery::count) buffer_size += 5;
+        buffer_size += 4;
+        alloc_memory (&send_buffer, buffer_size, "Output::pack");
+        alloc_memory (&recv_buffer, buffer_size, "Output::pack");
+    }
     for (int i=0; i<num_files; i++)
     {
+        if (power[i]) for (int j=0; j<=k_max_residents; j++) send_buffer[pos++] = power[i][j];
+        if (value_ptr_2[i]) send_buffer[pos++] = *value_ptr_2[i];
+    }
+    if (Battery::count)
+    {
+        send_buffer[pos++] = *charge_total;
+        send_buffer[pos++] = *power_charging_total;
+        send_buffer[pos++] = *power_discharging_total;
+        send_buffer[pos++] = *loss_charging_total;
+        send_buffer[pos++] = *loss_discharging_total;
+    }
+    send_buffer[pos++] = *power_to_grid_total;
+    send_buffer[pos++] = *power_from_grid_total;
+    send_buffer[pos++] = *power_above_limit_total;
+    send_buffer[pos++] = *battery_from_grid_total;
+    buffer_time = sim_clock->yeartime/3600.;
+}
+
+
+void Output::start_reduction()
+{
 #ifdef PARALLEL
-        if (rank == 0)
-            MPI_Reduce (MPI_IN_PLACE, power[i], k_max_residents+1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-        else
-            MPI_Reduce (power[i], power[i], k_max_residents+1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    ProfileScope scope (PROFILE_MPI);
+#if MPI_VERSION >= 3
+    // The reduction runs in the background while the next timestep is simulated
+    MPI_Ireduce (send_buffer, recv_buffer, buffer_size, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD, &request);
+#else
+    MPI_Reduce (send_buffer, recv_buffer, buffer_size, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    request = MPI_REQUEST_NULL;
 #endif
-        if (rank == 0)
+#else
+    for (int i=0; i<buffer_size; i++) recv_buffer[i] = send_buffer[i];
+#endif
+    pending = true;
+}
+
+
+// Print the values of the current timestep. The files lag one timestep behind
+// the simulation, because the values are printed once the reduction started
+// here has completed, i.e. at the next call of print() or flush().
+
+void Output::print()
+{
+    ProfileScope scope (PROFILE_OUTPUT);
+    flush();
+    pack();
+    start_reduction();
+}
+
+
+void Output::flush()
+{
+    if (!pending) return;
+#ifdef PARALLEL
+    Profiler::start (PROFILE_MPI);
+    MPI_Wait (&request, MPI_STATUS_IGNORE);
+    Profiler::stop (PROFILE_MPI);
+#endif
+    pending = false;
+    if (rank == 0)
+    {
+        double *values = recv_buffer;
+        print_power (&values);
+        print_battery_stats (&values);
+        print_gridbalance (&values);
+    }
+}
+
+
+// The values of the previous timestep are printed and all rows are written,
+// so that the size of the time series files matches the checkpoint.
+
+void Output::write_checkpoint (FILE *fp)
+{
+    long size[k_max_files+2];
+
+    flush();
+    writer->sync();
+    for (int i=0; i<k_max_files+2; i++) size[i] = 0;
+    if (rank == 0)
+    {
+        for (int i=0; i<num_files; i++)
         {
-            fprintf (file_ptr[i], "%lf", sim_clock->yeartime/3600.);
-            for (int j=0; j<=k_max_residents; j++)
-            {
-                fprintf (file_ptr[i], " %lf", power[i][j]);
-            }
+            fflush (file_ptr[i]);
+            size[i] = ftell (file_ptr[i]);
         }
-        if (value_ptr_2[i])
+        if (battery_file)
         {
-#ifdef PARALLEL
-            if (rank == 0)
-                MPI_Reduce (MPI_IN_PLACE, value_ptr_2[i], 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            else
-                MPI_Reduce (value_ptr_2[i], value_ptr_2[i], 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-#endif
-            if (rank == 0) fprintf (file_ptr[i], " %lf", *value_ptr_2[i]);
+            fflush (battery_file);
+            size[k_max_files] = ftell (battery_file);
+        }
+        if (gridbalance_file)
+        {
+            fflush (gridbalance_file);
+            size[k_max_files+1] = ftell (gridbalance_file);
         }
-        if (rank == 0) fprintf (file_ptr[i], "\n");
     }
+    write_checkpoint_data (fp, &num_files, sizeof (num_files));
+    write_checkpoint_data (fp, size, sizeof (size));
 }
 
 
-void Output::print_battery_stats()
+// With resume_files = false the output starts from scratch (see open_files)
+
+void Output::read_checkpoint (FILE *fp, bool resume_files)
 {
-    if (Battery::count)
+    read_checkpoint_data (fp, &resume_num_files, sizeof (resume_num_files));
+    read_checkpoint_data (fp, resume_size, sizeof (resume_size));
+    resume = resume_files;
+}
+
+
+void Output::print_power (double **values)
+{
+    double *start[k_max_files];
+    double row[k_max_residents+3];
+
+    for (int i=0; i<num_files; i++)
     {
-#ifdef PARALLEL
-        if (rank == 0)
+        int n = 0;
+        row[n++] = buffer_time;
+        if (power[i])
         {
-            MPI_Reduce (MPI_IN_PLACE, charge_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (MPI_IN_PLACE, power_charging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (MPI_IN_PLACE, power_discharging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (MPI_IN_PLACE, loss_charging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (MPI_IN_PLACE, loss_discharging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            start[i] = *values;
+            for (int j=0; j<=k_max_residents; j++) row[n++] = *(*values)++;
         }
         else
         {
-            MPI_Reduce (charge_total, charge_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (power_charging_total, power_charging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (power_discharging_total, power_discharging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (loss_charging_total, loss_charging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-            MPI_Reduce (loss_discharging_total, loss_discharging_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            double *real = start[real_index[i]];
+            double *reactive = start[real_index[i]+1];
+            for (int j=0; j<=k_max_residents; j++)
+            {
+                row[n++] = sqrt (real[j]*real[j] + reactive[j]*reactive[j]);
+            }
         }
-#endif
-        if (rank == 0) fprintf (battery_file, "%lf %lf %lf %lf %lf %lf\n",
-                               sim_clock->yeartime/3600.,
-                               *charge_total/Battery::count,
-                               *power_charging_total,
-                               *power_discharging_total,
-                               *loss_charging_total,
-                               *loss_discharging_total);
+        if (value_ptr_2[i]) row[n++] = *(*values)++;
+        writer->row (file_ptr[i], row, n);
     }
 }
 
 
-void Output::print_gridbalance()
+void Output::print_battery_stats (double **values)
 {
-#ifdef PARALLEL
-    if (rank == 0)
-    {
-        MPI_Reduce (MPI_IN_PLACE, power_to_grid_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce (MPI_IN_PLACE, power_from_grid_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce (MPI_IN_PLACE, power_above_limit_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce (MPI_IN_PLACE, battery_from_grid_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-    }
-    else
+    if (Battery::count)
     {
-        MPI_Reduce (power_to_grid_total, power_to_grid_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce (power_from_grid_total, power_from_grid_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce (power_above_limit_total, power_above_limit_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce (battery_from_grid_total, battery_from_grid_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        double *v = *values;
+        double row[] = {buffer_time,
+                        v[0]/Battery::count,
+                        v[1],
+                        v[2],
+                        v[3],
+                        v[4]};
+        writer->row (battery_file, row, 6);
+        *values += 5;
     }
-#endif
-    if (rank == 0) fprintf (gridbalance_file, "%lf %lf %lf %lf %lf %lf\n",
-                            sim_clock->yeartime/3600.,
-                            (*power_to_grid_total - *power_from_grid_total),
-                            *power_from_grid_total,
-                            *power_to_grid_total,
-                            *power_above_limit_total,
-                            *battery_from_grid_total);
+}
+
 
+void Output::print_gridbalance (double **values)
+{
+    double *v = *values;
+    double row[] = {buffer_time,
+                    (v[0] - v[1]),
+                    v[1],
+                    v[0],
+                    v[2],
+                    v[3]};
+    writer->row (gridbalance_file, row, 6);
+    *values += 4;
 }
 
 
@@ -388,7 +554,7 @@ void Output::print_consumption (int year)
         fprintf (fp, "Households          ");
     }
     Household::calc_consumption();
-    for (res=0; res<=k_max_residents; res++) median[res] = Household::median(res);
+    Household::median (median);
     if (rank == 0)
     {
         for (res=1; res<=k_max_residents; res++) fprintf (fp, "%16d", Household::count[res]);
@@ -566,34 +732,24 @@ void Output::print_households (int year)
 {
     FILE *fp1[k_max_residents+1];
     FILE *fp2[k_max_residents+1];
-    char file_name[k_max_path], mode[2]="w";
+    char file_name[k_max_path];
     int res;
-#ifdef PARALLEL
-    MPI_Status status;
-    char finished;
 
-    if (rank > 0)
-    {
-        MPI_Recv (&finished, 1, MPI_CHAR, rank-1, 1, MPI_COMM_WORLD, &status);
-        mode[0] = 'a';
-    }
-#endif
     for (res=1; res<=k_max_residents; res++)
     {
         snprintf (file_name, sizeof(file_name), "households.%d.%d", year, res);
-        open_file (fp1+res, file_name, mode);
+        open_shared_file (fp1+res, file_name);
         snprintf (file_name, sizeof(file_name), "appliances.%d.%d", year, res);
-        open_file (fp2+res, file_name, mode);
+        open_shared_file (fp2+res, file_name);
     }
     Household::print (fp1, fp2);
     for (res=1; res<=k_max_residents; res++)
     {
-        fclose (fp1[res]);
-        fclose (fp2[res]);
+        snprintf (file_name, sizeof(file_name), "households.%d.%d", year, res);
+        close_shared_file (fp1[res], file_name);
+        snprintf (file_name, sizeof(file_name), "appliances.%d.%d", year, res);
+        close_shared_file (fp2[res], file_name);
     }
-#ifdef PARALLEL
-    if (rank < num_processes-1) MPI_Send (&finished, 1, MPI_CHAR, rank+1, 1, MPI_COMM_WORLD);
-#endif
 }
 
 
@@ -601,34 +757,24 @@ void Output::print_max (int year)
 {
     FILE *fp1[k_max_residents+1];
     FILE *fp2[k_max_residents+1];
-    char file_name[k_max_path], mode[2]="w";
+    char file_name[k_max_path];
     int res;
-#ifdef PARALLEL
-    MPI_Status status;
-    char finished;
 
-    if (rank > 0)
-    {
-        MPI_Recv (&finished, 1, MPI_CHAR, rank-1, 1, MPI_COMM_WORLD, &status);
-        mode[0] = 'a';
-    }
-#endif
     for (res=1; res<=k_max_residents; res++)
     {
         snprintf (file_name, sizeof(file_name), "max.%d.%d", year, res);
-        open_file (fp1+res, file_name, mode);
+        open_shared_file (fp1+res, file_name);
         snprintf (file_name, sizeof(file_name), "max_sol.%d.%d", year, res);
-        open_file (fp2+res, file_name, mode);
+        open_shared_file (fp2+res, file_name);
     }
     Household::print_max (fp1, fp2);
     for (res=1; res<=k_max_residents; res++)
     {
-        fclose (fp1[res]);
-        fclose (fp2[res]);
+        snprintf (file_name, sizeof(file_name), "max.%d.%d", year, res);
+        close_shared_file (fp1[res], file_name);
+        snprintf (file_name, sizeof(file_name), "max_sol.%d.%d", year, res);
+        close_shared_file (fp2[res], file_name);
     }
-#ifdef PARALLEL
-    if (rank < num_processes-1) MPI_Send (&finished, 1, MPI_CHAR, rank+1, 1, MPI_COMM_WORLD);
-#endif
 }
 
 
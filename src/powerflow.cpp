@@ -51,6 +51,7 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "solarmodule.H"
 #include "battery.H"
 #include "powerflow.H"
+#include "profiler.H"
 
 #define DELTA 10  // number of files to be saved before and after a signal point, e.g. a point at which the
                   // households receive a 'reduce consumption' or a 'raise consumption' signal
@@ -61,6 +62,21 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 static int compare_households_1 (const void *h1, const void *h2);
 static int compare_households_2 (const void *h1, const void *h2);
 
+// Column names of the transformer and bus output files
+const int k_num_trafo_columns = 14;
+const char *const k_trafo_columns[k_num_trafo_columns] =
+{
+    "time", "min_bus", "min_magnitude", "fraction_reduce", "max_bus", "max_magnitude",
+    "fraction_raise", "power_out", "max_power", "consumption", "production",
+    "max_household_power", "max_household_bus", "max_household"
+};
+const unsigned int k_trafo_integer_columns = 1<<1 | 1<<3 | 1<<4 | 1<<6 | 1<<12 | 1<<13;
+const int k_num_bus_columns = 5;
+const char *const k_bus_columns[k_num_bus_columns] =
+{
+    "time", "magnitude", "power_in", "consumption", "production"
+};
+
 
 Powerflow::Powerflow (int num_households)
 {
@@ -79,6 +95,8 @@ Powerflow::Powerflow (int num_households)
     trafo_info = NULL;
     signal_points = NULL;
     hh_to_bus = NULL;
+    power_from = NULL;
+    power_to = NULL;
 
     // Delete directories from the previous calculation...
     shell_command ("rm -rf pfin pfout");
@@ -87,22 +105,25 @@ Powerflow::Powerflow (int num_households)
 
     // Create options file for pf/power
 
-    FILE *options_file = NULL;
+    if (config->powerflow.solver == PETSC)
+    {
+        FILE *options_file = NULL;
 #ifdef HAVE_PF
-    open_file (&options_file, "pfoptions", "w");
+        open_file (&options_file, "pfoptions", "w");
 #else
-    open_file (&options_file, "poweroptions", "w");
+        open_file (&options_file, "poweroptions", "w");
 #endif
-    fprintf (options_file, "-snes_type newtonls\n");
-    fprintf (options_file, "-snes_atol 1e-8\n");
-    fprintf (options_file, "-snes_rtol 1e-20\n");
-    fprintf (options_file, "-snes_linesearch_type basic\n");
-    fprintf (options_file, "-ksp_type gmres\n");
-    fprintf (options_file, "-pc_type bjacobi\n");
-    fprintf (options_file, "-sub_pc_type lu\n");
-    fprintf (options_file, "-sub_pc_factor_mat_ordering_type qmd\n");
-    fprintf (options_file, "-sub_pc_factor_shift_type NONZERO\n");
-    fclose (options_file);
+        fprintf (options_file, "-snes_type newtonls\n");
+        fprintf (options_file, "-snes_atol 1e-8\n");
+        fprintf (options_file, "-snes_rtol 1e-20\n");
+        fprintf (options_file, "-snes_linesearch_type basic\n");
+        fprintf (options_file, "-ksp_type gmres\n");
+        fprintf (options_file, "-pc_type bjacobi\n");
+        fprintf (options_file, "-sub_pc_type lu\n");
+        fprintf (options_file, "-sub_pc_factor_mat_ordering_type qmd\n");
+        fprintf (options_file, "-sub_pc_factor_shift_type NONZERO\n");
+        fclose (options_file);
+    }
 
     // Read the MATPOWER case file
 
@@ -180,6 +201,10 @@ Powerflow::Powerflow (int num_households)
         line_nr++;
     }
     fclose (case_file);
+    alloc_memory (&power_from, num_branches, function_name);
+    alloc_memory (&power_to, num_branches, function_name);
+    if (config->powerflow.solver != PETSC) init_newton();
+    if (config->powerflow.solver == BACKWARD_FORWARD_SWEEP) init_sweep();
 
     // Read the file, which contains the relation between buses and households.
     // It is named like the case file with '.ext' as suffix.
@@ -248,9 +273,7 @@ Powerflow::Powerflow (int num_households)
                 if (token[1] == '\n') token[1] = '\0';
                 if (strlen(token) == 1 && (token[0]=='t' || token[0]=='T'))
                 {
-                    char filename[k_max_path];
-                    snprintf (filename, sizeof(filename), "bus.%d.%d", sim_clock->year, bus_nr);
-                    open_file (&bus_info[bus_nr-1].file, filename, "w");
+                    open_output_file (&bus_info[bus_nr-1].file, "bus", bus_nr, k_num_bus_columns, k_bus_columns);
                 }
                 else if (strlen(token) == 1 && (token[0]=='f' || token[0]=='F')) bus_info[bus_nr-1].file = NULL;
                 else
@@ -308,9 +331,7 @@ Powerflow::Powerflow (int num_households)
                 if (token[1] == '\n') token[1] = '\0';
                 if (strlen(token) == 1 && (token[0]=='t' || token[0]=='T'))
                 {
-                    char filename[k_max_path];
-                    snprintf (filename, sizeof(filename), "bus.%d.%d", sim_clock->year, bus_nr);
-                    open_file (&bus_info[bus_nr-1].file, filename, "w");
+                    open_output_file (&bus_info[bus_nr-1].file, "bus", bus_nr, k_num_bus_columns, k_bus_columns);
                 }
                 else if (strlen(token) == 1 && (token[0]=='f' || token[0]=='F')) bus_info[bus_nr-1].file = NULL;
                 else
@@ -443,11 +464,9 @@ Powerflow::Powerflow (int num_households)
 
     if (config->powerflow.output_level > 0)
     {
-        char filename[k_max_path];
         for (int t=0; t<num_transformers; t++)
         {
-            snprintf (filename, sizeof(filename), "trafo.%d.%d", sim_clock->year, trafo_info[t].bus_nr);
-            open_file (&trafo_info[t].file, filename, "w");
+            open_output_file (&trafo_info[t].file, "trafo", trafo_info[t].bus_nr, k_num_trafo_columns, k_trafo_columns);
         }
     }
 
@@ -466,6 +485,10 @@ Powerflow::~Powerflow()
     delete [] generator;
     delete [] branch;
     delete [] hh_to_bus;
+    delete [] power_from;
+    delete [] power_to;
+    if (config->powerflow.solver != PETSC) delete_newton();
+    if (config->powerflow.solver == BACKWARD_FORWARD_SWEEP) delete_sweep();
     for (int i=0; i<num_buses; i++)
     {
         if (bus_info[i].num_hh)
@@ -516,48 +539,58 @@ Powerflow::~Powerflow()
 void Powerflow::simulate()
 {
     double time = sim_clock->cur_time;
-    char command[64], *line = NULL;
-    int from, to;               // bus numbers at both ends of a branch
-    double pwr_from, pwr_to;    // power at both ends of a branch
+    char command[64];
     int t, count;
+    ProfileScope scope (PROFILE_POWERFLOW);
 
-    // Prepare the input file (pf_input) for the power flow solver pf/power...
-    prepare_input_file();
-    // ...and start pf/power
-#ifdef HAVE_PF
-    snprintf (command, sizeof(command), "pf -pfdata pf_input");
-#else
-    snprintf (command, sizeof(command), "power -pfdata pf_input");
-#endif
-    shell_command (command);
-
-    // Read the result file
-    FILE *fp = NULL;
-    open_file (&fp, "results", "r");
-
-    // Bus data
-    read_line (fp, &line);  // read the first 2 lines
-    read_line (fp, &line);  // which don't contain any info we need
-    for (int i=0; i<num_buses; i++)
+    update_loads();
+    if (config->powerflow.solver != PETSC)
     {
-        read_line (fp, &line);
-        if (bus_info[i].num_hh)  // it is a household bus
+        // If the sweeps don't converge, the Newton-Raphson solver takes over
+        Profiler::start (PROFILE_POWERFLOW_SOLVER);
+        bool solved = config->powerflow.solver == BACKWARD_FORWARD_SWEEP && sweep.radial && solve_sweep();
+        if (!solved && !solve_newton())
         {
-            sscanf (line, "%*d %*s %lf %*s %*s %*s", &bus_info[i].magnitude);
+            // Try once more from the voltages of the case file
+            // instead of those of the previous call
+            delete_newton();
+            init_newton();
+            if (!solve_newton())
+            {
+                fprintf (stderr, "\nWARNING: The power flow calculation at t = %.2lf h did not converge.\n", time/3600.);
+            }
+        }
+        Profiler::stop (PROFILE_POWERFLOW_SOLVER);
+        for (int i=0; i<num_buses; i++)
+        {
+            if (bus_info[i].num_hh) bus_info[i].magnitude = newton.v_mag[i];
+        }
+        if (config->powerflow.output_level > 0) calc_branch_flows();
+        if (config->powerflow.output_level > 1)
+        {
+            Profiler::start (PROFILE_POWERFLOW_INPUT);
+            prepare_input_file();
+            Profiler::stop (PROFILE_POWERFLOW_INPUT);
+            Profiler::start (PROFILE_POWERFLOW_RESULTS);
+            write_results_file();
+            Profiler::stop (PROFILE_POWERFLOW_RESULTS);
         }
     }
+    else run_petsc();
+
     // Line data
     if (config->powerflow.output_level > 0)
     {
+        int from, to;               // bus numbers at both ends of a branch
+        double pwr_from, pwr_to;    // power at both ends of a branch
         for (int b=0; b<num_buses; b++) bus_info[b].power_in = 0.;
         for (int t=0; t<num_transformers; t++) trafo_info[t].power_out = 0.;
-        // Read the 'Line data' line and the header line
-        read_line (fp, &line);
-        read_line (fp, &line);
         for (int i=0; i<num_branches; i++)
         {
-            read_line (fp, &line);
-            sscanf (line, "%d %d %lf %lf %*f %*d", &from, &to, &pwr_from, &pwr_to);
+            from = branch[i].from;
+            to = branch[i].to;
+            pwr_from = power_from[i];
+            pwr_to = power_to[i];
             // We are looking at branches with a transformer at the 'from' end
             // in order to get the output power
             if (bus_info[from-1].trafo_bus == from)
@@ -581,7 +614,6 @@ void Powerflow::simulate()
             }
         }
     }
-    fclose (fp); // Close the results file
 
     // Check all buses for min and max voltage and react if necessary
     // The buses are arranged in groups, with each group beeing served by one
@@ -726,16 +758,16 @@ void Powerflow::simulate()
             // - maximum consumption of a household
             // - the bus to which the max. consumption household is attached to
             // - the id of the household with max. consumption
-            fprintf (trafo_info[t].file, "%lf %d %lf %d %d %lf %d %lf %lf %lf %lf %lf %d %d\n",
-                     time/3600.,
-                     trafo_info[t].min_bus, trafo_info[t].min_magnitude, trafo_info[t].fraction_reduce,
-                     trafo_info[t].max_bus, trafo_info[t].max_magnitude, trafo_info[t].fraction_raise,
-                     trafo_info[t].power_out, max_power*1000.,
-                     sum_power_in_range (trafo_info[t].hh_list, trafo_info[t].num_hh),
-                     sum_production_in_range (trafo_info[t].hh_list, trafo_info[t].num_hh),
-                     max_power_in_range (trafo_info[t].hh_list, trafo_info[t].num_hh),
-                     hh_to_bus[trafo_info[t].hh_list[0]->number-1],
-                     trafo_info[t].hh_list[0]->number);
+            double row[] = {time/3600.,
+                            (double)trafo_info[t].min_bus, trafo_info[t].min_magnitude, (double)trafo_info[t].fraction_reduce,
+                            (double)trafo_info[t].max_bus, trafo_info[t].max_magnitude, (double)trafo_info[t].fraction_raise,
+                            trafo_info[t].power_out, max_power*1000.,
+                            sum_power_in_range (trafo_info[t].hh_list, trafo_info[t].num_hh),
+                            sum_production_in_range (trafo_info[t].hh_list, trafo_info[t].num_hh),
+                            max_power_in_range (trafo_info[t].hh_list, trafo_info[t].num_hh),
+                            (double)hh_to_bus[trafo_info[t].hh_list[0]->number-1],
+                            (double)trafo_info[t].hh_list[0]->number};
+            writer->row (trafo_info[t].file, row, k_num_trafo_columns, k_trafo_integer_columns);
         }
     }
 
@@ -752,12 +784,12 @@ void Powerflow::simulate()
                 // - input power at bus
                 // - consumption at bus
                 // - production at bus (solar modules)
-                fprintf (bus_info[b].file, "%lf %lf %lf %lf %lf\n",
-                         time/3600.,
-                         bus_info[b].magnitude,
-                         bus_info[b].power_in,
-                         sum_power_in_range (bus_info[b].hh_list, bus_info[b].num_hh),
-                         sum_production_in_range (bus_info[b].hh_list, bus_info[b].num_hh));
+                double row[] = {time/3600.,
+                                bus_info[b].magnitude,
+                                bus_info[b].power_in,
+                                sum_power_in_range (bus_info[b].hh_list, bus_info[b].num_hh),
+                                sum_production_in_range (bus_info[b].hh_list, bus_info[b].num_hh)};
+                writer->row (bus_info[b].file, row, k_num_bus_columns);
             }
         }
     }
@@ -774,6 +806,75 @@ void Powerflow::simulate()
 }
 
 
+// Run the external power flow solver pf/power and read its results
+
+void Powerflow::run_petsc()
+{
+    char command[64], *line = NULL;
+    int from, to;
+
+    // Prepare the input file (pf_input) for the power flow solver pf/power...
+    Profiler::start (PROFILE_POWERFLOW_INPUT);
+    prepare_input_file();
+    Profiler::stop (PROFILE_POWERFLOW_INPUT);
+    // ...and start pf/power
+#ifdef HAVE_PF
+    snprintf (command, sizeof(command), "pf -pfdata pf_input");
+#else
+    snprintf (command, sizeof(command), "power -pfdata pf_input");
+#endif
+    Profiler::start (PROFILE_POWERFLOW_SOLVER);
+    shell_command (command);
+    Profiler::stop (PROFILE_POWERFLOW_SOLVER);
+
+    // Read the result file
+    ProfileScope scope (PROFILE_POWERFLOW_RESULTS);
+    FILE *fp = NULL;
+    open_file (&fp, "results", "r");
+
+    // Bus data
+    read_line (fp, &line);  // read the first 2 lines
+    read_line (fp, &line);  // which don't contain any info we need
+    for (int i=0; i<num_buses; i++)
+    {
+        read_line (fp, &line);
+        if (bus_info[i].num_hh)  // it is a household bus
+        {
+            sscanf (line, "%*d %*s %lf %*s %*s %*s", &bus_info[i].magnitude);
+        }
+    }
+    // Line data
+    if (config->powerflow.output_level > 0)
+    {
+        // Read the 'Line data' line and the header line
+        read_line (fp, &line);
+        read_line (fp, &line);
+        for (int i=0; i<num_branches; i++)
+        {
+            read_line (fp, &line);
+            sscanf (line, "%d %d %lf %lf %*f %*d", &from, &to, power_from+i, power_to+i);
+        }
+    }
+    fclose (fp); // Close the results file
+}
+
+
+// Set the load of each household bus to the net power the households
+// attached to it draw from the grid
+
+void Powerflow::update_loads()
+{
+    for (int i=0; i<num_buses; i++)
+    {
+        if (bus_info[i].num_hh > 0)
+        {
+            bus[i].Pd = Pd (bus_info[i].hh_list, bus_info[i].num_hh);
+            bus[i].Qd = Qd (bus_info[i].hh_list, bus_info[i].num_hh);
+        }
+    }
+}
+
+
 void Powerflow::prepare_input_file()
 {
     FILE *fp = NULL;
@@ -787,11 +888,6 @@ void Powerflow::prepare_input_file()
     fprintf (fp, "mpc.bus = [\n");
     for (int i=0; i<num_buses; i++)
     {
-        if (bus_info[i].num_hh > 0)
-        {
-            bus[i].Pd = Pd (bus_info[i].hh_list, bus_info[i].num_hh);
-            bus[i].Qd = Qd (bus_info[i].hh_list, bus_info[i].num_hh);
-        }
         fprintf (fp, "%8d %8d     %.2E     %.2E     %.2E     %.2E %5d %8.2lf %8.2lf %10.2lf %5d %8.2lf %8.2lf;\n",
                  bus[i].nr, bus[i].type, bus[i].Pd, bus[i].Qd, bus[i].Gs, bus[i].Bs, bus[i].area,
                  bus[i].Vm, bus[i].Va, bus[i].baseKV, bus[i].zone, bus[i].Vmax, bus[i].Vmin);
@@ -1018,6 +1114,21 @@ double Powerflow::Qd (Household* list[], int list_length)
 }
 
 
+// Open a transformer or bus output file. The time in these files starts
+// at the begin of the simulation.
+
+void Powerflow::open_output_file (FILE **file, const char kind[], int bus_nr,
+                                  int num_columns, const char *const columns[])
+{
+    char filename[k_max_path];
+
+    snprintf (filename, sizeof(filename), "%s.%d.%d", kind, sim_clock->year, bus_nr);
+    open_series_file (file, filename, num_columns, columns,
+                      config->start.year, config->start.month, config->start.day, config->start.time,
+                      config->timestep_size * config->powerflow.step_size);
+}
+
+
 static int compare_households_1 (const void *h1, const void *h2)
 {
     Household *ptr1 = *(Household**)h1;
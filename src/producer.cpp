@@ -50,13 +50,20 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "globals.H"
 #include "proto.H"
 #include "producer.H"
+#include "profiler.H"
 
-static int compare_fridges (const void *f1, const void *f2);
-static int compare_freezers (const void *f1, const void *f2);
+enum HeapOrder {COLDEST = 1, WARMEST = -1};
+template <class AP> static void make_heap (AP **list, int n, HeapOrder order);
+template <class AP> static AP *pop_heap (AP **list, int *n, HeapOrder order);
+template <class AP> static void write_list (FILE *fp, AP **list, int n);
+template <class AP> static void read_list (FILE *fp, AP **list, int n);
+#ifdef PARALLEL
+static void global_sum (int *finished, double *power_global);
+template <class AP> static double switch_globally (AP **list, int n, HeapOrder order, double excess);
+#endif
 
 Producer::Producer()
 {
-    const char function_name[] = "Producer::Producer";
     maximum_peak = 0.;
     profile_fp = NULL;
     profile_data = NULL;
@@ -65,13 +72,43 @@ Producer::Producer()
     power_fp = NULL;
     power = 0.;
     power_gradient = 0.;
+    delta_pos = -1;
+    compensating = false;
+    limit_0 = 0.;
+    time_0 = 0;
     fridge = NULL;
     freezer = NULL;
     vehicle = NULL;
+    num_fridges = num_freezers = num_vehicles = 0;
+    price_intervals = NULL;
+    range_min = range_max = NULL;
+    range_log = NULL;
+    for (int i=0; i<NUM_PRICE_TABLES; i++) price_table[i] = NULL;
+
+    init_settings();
+    if (config->fridge.smartgrid_enabled > 0.) num_fridges = Fridge::create_smart_list (&fridge);
+    if (config->freezer.smartgrid_enabled > 0.) num_freezers = Freezer::create_smart_list (&freezer);
+    if (config->e_vehicle.smartgrid_enabled > 0.) num_vehicles = E_Vehicle::create_smart_list (&vehicle);
+}
+
+
+Producer::~Producer()
+{
+    free_settings();
+}
+
+
+// Everything that depends on the settings a scenario may change
+// (control mode and price tables, see Configuration::read_scenario)
+
+void Producer::init_settings()
+{
+    const char function_name[] = "Producer::init_settings";
 
     init_price_table (GRID);
     init_price_table (SOLAR);
     init_price_intervals();
+    init_price_ranges();
 
     if (config->control == PROFILE)
     {
@@ -92,26 +129,126 @@ Producer::Producer()
             fscanf (delta_fp, "%lf", delta_data+i);
         }
         fclose (delta_fp);
-        if (rank == 0) open_file (&power_fp, "power_Producer", "w");
+        // A resumed simulation continues the file (see read_checkpoint)
+        if (rank == 0) open_file (&power_fp, "power_Producer", config->checkpoint.restart == 1 ? "r+" : "w");
     }
-    if (config->fridge.smartgrid_enabled > 0.) num_fridges = Fridge::create_smart_list (&fridge);
-    if (config->freezer.smartgrid_enabled > 0.) num_freezers = Freezer::create_smart_list (&freezer);
-    if (config->e_vehicle.smartgrid_enabled > 0.) num_vehicles = E_Vehicle::create_smart_list (&vehicle);
 }
 
 
-Producer::~Producer()
+void Producer::free_settings()
 {
     delete [] price_intervals;
+    delete [] range_min;
+    delete [] range_max;
+    delete [] range_log;
     for (int i=0; i<NUM_PRICE_TABLES; i++) delete [] price_table[i];
-    if (config->control == PROFILE) delete [] profile_data;
-    if (config->control == COMPENSATE) delete [] delta_data;
+    delete [] profile_data;
+    delete [] delta_data;
+    if (power_fp) fclose (power_fp);
+    price_intervals = NULL;
+    range_min = range_max = NULL;
+    range_log = NULL;
+    for (int i=0; i<NUM_PRICE_TABLES; i++) price_table[i] = NULL;
+    profile_data = NULL;
+    delta_data = NULL;
+    power_fp = NULL;
+}
+
+
+// Called when the settings have changed for a scenario
+
+void Producer::reconfigure()
+{
+    free_settings();
+    init_settings();
+}
+
+
+// The order of the smart fridges, freezers and vehicles changes with every
+// heap built from them, so the lists are part of a checkpoint as well.
+
+void Producer::write_checkpoint (FILE *fp)
+{
+    long size = 0;
+
+    write_checkpoint_data (fp, &maximum_peak, sizeof (maximum_peak));
+    write_checkpoint_data (fp, &power, sizeof (power));
+    write_checkpoint_data (fp, &power_gradient, sizeof (power_gradient));
+    write_checkpoint_data (fp, &delta_pos, sizeof (delta_pos));
+    write_checkpoint_data (fp, &compensating, sizeof (compensating));
+    write_checkpoint_data (fp, &limit_0, sizeof (limit_0));
+    write_checkpoint_data (fp, &time_0, sizeof (time_0));
+    write_list (fp, fridge, num_fridges);
+    write_list (fp, freezer, num_freezers);
+    write_list (fp, vehicle, num_vehicles);
+    if (power_fp)
+    {
+        fflush (power_fp);
+        size = ftell (power_fp);
+    }
+    write_checkpoint_data (fp, &size, sizeof (size));
+}
+
+
+void Producer::read_checkpoint (FILE *fp, bool resume_files)
+{
+    long size;
+
+    read_checkpoint_data (fp, &maximum_peak, sizeof (maximum_peak));
+    read_checkpoint_data (fp, &power, sizeof (power));
+    read_checkpoint_data (fp, &power_gradient, sizeof (power_gradient));
+    read_checkpoint_data (fp, &delta_pos, sizeof (delta_pos));
+    read_checkpoint_data (fp, &compensating, sizeof (compensating));
+    read_checkpoint_data (fp, &limit_0, sizeof (limit_0));
+    read_checkpoint_data (fp, &time_0, sizeof (time_0));
+    read_list (fp, fridge, num_fridges);
+    read_list (fp, freezer, num_freezers);
+    read_list (fp, vehicle, num_vehicles);
+    read_checkpoint_data (fp, &size, sizeof (size));
+    if (power_fp && resume_files) truncate_file (power_fp, size);
+}
+
+
+template <class AP>
+static void write_list (FILE *fp, AP **list, int n)
+{
+    write_checkpoint_data (fp, &n, sizeof (n));
+    for (int i=0; i<n; i++)
+    {
+        int index = list[i] - AP::apps;
+        write_checkpoint_data (fp, &index, sizeof (index));
+    }
+}
+
+
+template <class AP>
+static void read_list (FILE *fp, AP **list, int n)
+{
+    int num, index;
+
+    read_checkpoint_data (fp, &num, sizeof (num));
+    if (num != n)
+    {
+        fprintf (stderr, "The smart appliances don't match the checkpoint.\n");
+        exit (1);
+    }
+    for (int i=0; i<n; i++)
+    {
+        read_checkpoint_data (fp, &index, sizeof (index));
+        if (index < 0 || index >= AP::num_apps)
+        {
+            fprintf (stderr, "The smart appliances don't match the checkpoint.\n");
+            exit (1);
+        }
+        list[i] = AP::apps + index;
+    }
 }
 
 
 void Producer::update_maximum_peak()
 {
 #ifdef PARALLEL
+    ProfileScope scope (PROFILE_MPI);
     if (rank == 0)
         MPI_Reduce (MPI_IN_PLACE, Household::real_power_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
     else
@@ -123,11 +260,8 @@ void Producer::update_maximum_peak()
 
 void Producer::simulate (double cur_time)
 {
+    ProfileScope scope (PROFILE_PRODUCER);
     double upper_limit, lower_limit;
-    static int pos = -1;
-    static bool flag = false;
-    static double limit_0;
-    static int time_0;
     int i;
     int time = cur_time/60.;  // the simulation time in minutes
 #ifdef PARALLEL
@@ -164,13 +298,13 @@ void Producer::simulate (double cur_time)
         case COMPENSATE:
             if (time % 15 == 0 && time < 2880)  // delta_data available every 15 minutes
             {
-                pos++;  // adjust read position
+                delta_pos++;  // adjust read position
             }
-            if (!flag)
+            if (!compensating)
             {
-                flag = true;
+                compensating = true;
                 time_0 = time;
-                limit_0 = (1.+ delta_data[pos]) * Household::real_power_total[0];
+                limit_0 = (1.+ delta_data[delta_pos]) * Household::real_power_total[0];
                 power_gradient = (Household::real_power_total[0] - limit_0) / 60.;
             }
 
@@ -200,7 +334,9 @@ void Producer::simulate (double cur_time)
             exit (1);
     }
 #ifdef PARALLEL
+    Profiler::start (PROFILE_MPI);
     MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    Profiler::stop (PROFILE_MPI);
     if (power_global > upper_limit)
 #else
     if (Household::real_power_total[0] > upper_limit)
@@ -208,57 +344,33 @@ void Producer::simulate (double cur_time)
     {
         if (config->fridge.smartgrid_enabled)
         {
-            qsort (fridge, (size_t)num_fridges, sizeof(class Fridge*), &compare_fridges);
             // turn off as many appliances as necessary to
-            // keep the total load below the upper limit
-            i = 0;
+            // keep the total load below the upper limit,
+            // the coldest ones first
 #ifdef PARALLEL
-            finished = 0;
-            while (power_global > upper_limit && finished < num_processes)
-            {
-                if (i<num_fridges)
-                {
-                    fridge[i]->turn_off();
-                    i++;
-                    finished = 0;
-                }
-                else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
+            power_global -= switch_globally (fridge, num_fridges, COLDEST, power_global-upper_limit);
 #else
-            while (Household::real_power_total[0] > upper_limit && i<num_fridges)
+            i = num_fridges;
+            make_heap (fridge, i, COLDEST);
+            while (Household::real_power_total[0] > upper_limit && i>0)
             {
-                fridge[i]->turn_off();
-                i++;
+                pop_heap (fridge, &i, COLDEST)->turn_off();
             }
 #endif
         }
         if (config->freezer.smartgrid_enabled)
         {
-            qsort (freezer, (size_t)num_freezers, sizeof(class Freezer*), &compare_freezers);
             // turn off as many appliances as necessary to
-            // keep the total load below the upper limit
-            i = 0;
+            // keep the total load below the upper limit,
+            // the coldest ones first
 #ifdef PARALLEL
-            finished = 0;
-            while (power_global > upper_limit && finished < num_processes)
-            {
-                if (i<num_freezers)
-                {
-                    freezer[i]->turn_off();
-                    i++;
-                    finished = 0;
-                }
-                else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
+            power_global -= switch_globally (freezer, num_freezers, COLDEST, power_global-upper_limit);
 #else
-            while (Household::real_power_total[0] > upper_limit && i<num_freezers)
+            i = num_freezers;
+            make_heap (freezer, i, COLDEST);
+            while (Household::real_power_total[0] > upper_limit && i>0)
             {
-                freezer[i]->turn_off();
-                i++;
+                pop_heap (freezer, &i, COLDEST)->turn_off();
             }
 #endif
         }
@@ -278,8 +390,7 @@ void Producer::simulate (double cur_time)
                     finished = 0;
                 }
                 else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+                global_sum (&finished, &power_global);
             }
 #else
             while (Household::real_power_total[0] > upper_limit && i<num_vehicles)
@@ -301,53 +412,29 @@ void Producer::simulate (double cur_time)
     {
         if (config->fridge.smartgrid_enabled)
         {
-            qsort (fridge, (size_t)num_fridges, sizeof(class Fridge*), &compare_fridges);
-            i = num_fridges-1;
+            // the warmest ones first
 #ifdef PARALLEL
-            finished = 0;
-            while (power_global < lower_limit && finished < num_processes)
-            {
-                if (i>=0)
-                {
-                    fridge[i]->turn_on();
-                    i--;
-                    finished = 0;
-                }
-                else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
+            power_global += switch_globally (fridge, num_fridges, WARMEST, lower_limit-power_global);
 #else
-            while (Household::real_power_total[0] < lower_limit && i>=0)
+            i = num_fridges;
+            make_heap (fridge, i, WARMEST);
+            while (Household::real_power_total[0] < lower_limit && i>0)
             {
-                fridge[i]->turn_on();
-                i--;
+                pop_heap (fridge, &i, WARMEST)->turn_on();
             }
 #endif
         }
         if (config->freezer.smartgrid_enabled)
         {
-            qsort (freezer, (size_t)num_freezers, sizeof(class Freezer*), &compare_freezers);
-            i = num_freezers-1;
+            // the warmest ones first
 #ifdef PARALLEL
-            finished = 0;
-            while (power_global < lower_limit && finished < num_processes)
-            {
-                if (i>=0)
-                {
-                    freezer[i]->turn_on();
-                    i--;
-                    finished = 0;
-                }
-                else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
+            power_global += switch_globally (freezer, num_freezers, WARMEST, lower_limit-power_global);
 #else
-            while (Household::real_power_total[0] < lower_limit && i>=0)
+            i = num_freezers;
+            make_heap (freezer, i, WARMEST);
+            while (Household::real_power_total[0] < lower_limit && i>0)
             {
-                freezer[i]->turn_on();
-                i--;
+                pop_heap (freezer, &i, WARMEST)->turn_on();
             }
 #endif
         }
@@ -365,8 +452,7 @@ void Producer::simulate (double cur_time)
                     finished = 0;
                 }
                 else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+                global_sum (&finished, &power_global);
             }
 #else
             while (Household::real_power_total[0] < lower_limit && i>=0)
@@ -389,53 +475,29 @@ void Producer::simulate (double cur_time)
 
         if (config->fridge.smartgrid_enabled)
         {
-            qsort (fridge, (size_t)num_fridges, sizeof(class Fridge*), &compare_fridges);
-            i = num_fridges-1;
+            // the warmest ones first
 #ifdef PARALLEL
-            finished = 0;
-            while (power_global < upper_limit && finished < num_processes)
-            {
-                if (i>=0)
-                {
-                    fridge[i]->turn_on();
-                    i--;
-                    finished = 0;
-                }
-                else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
+            power_global += switch_globally (fridge, num_fridges, WARMEST, upper_limit-power_global);
 #else
-            while (Household::real_power_total[0] < upper_limit && i>=0)
+            i = num_fridges;
+            make_heap (fridge, i, WARMEST);
+            while (Household::real_power_total[0] < upper_limit && i>0)
             {
-                fridge[i]->turn_on();
-                i--;
+                pop_heap (fridge, &i, WARMEST)->turn_on();
             }
 #endif
         }
         if (config->freezer.smartgrid_enabled)
         {
-            qsort (freezer, (size_t)num_freezers, sizeof(class Freezer*), &compare_freezers);
-            i = num_freezers-1;
+            // the warmest ones first
 #ifdef PARALLEL
-            finished = 0;
-            while (power_global < upper_limit && finished < num_processes)
-            {
-                if (i>=0)
-                {
-                    freezer[i]->turn_on();
-                    i--;
-                    finished = 0;
-                }
-                else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
+            power_global += switch_globally (freezer, num_freezers, WARMEST, upper_limit-power_global);
 #else
-            while (Household::real_power_total[0] < upper_limit && i>=0)
+            i = num_freezers;
+            make_heap (freezer, i, WARMEST);
+            while (Household::real_power_total[0] < upper_limit && i>0)
             {
-                freezer[i]->turn_on();
-                i--;
+                pop_heap (freezer, &i, WARMEST)->turn_on();
             }
 #endif
         }
@@ -453,8 +515,7 @@ void Producer::simulate (double cur_time)
                     finished = 0;
                 }
                 else finished = 1;
-                MPI_Allreduce (MPI_IN_PLACE, &finished, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce (Household::real_power_total, &power_global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+                global_sum (&finished, &power_global);
             }
 #else
             while (Household::real_power_total[0] < upper_limit && i>=0)
@@ -634,56 +695,260 @@ void Producer::best_price (double time, int preview_length, int *num, int interv
     }
 }
 
+// Find the first period with the minimum price within the given time interval.
+// best_start and best_end are given in seconds relative to start_time.
+
 void Producer::next_best_price_interval (double start_time, double end_time, int *best_start, int *best_end)
 {
-    int i;
     double min = min_price_in_time_interval (start_time, end_time);
-    int pos = int(start_time/60.) % price_table_length[GRID];  // pos marks an index in the price table
+    int n = price_table_length[GRID];
+    int pos = int(start_time/60.) % n;                         // pos marks an index in the price table
     int length = (end_time - start_time)/60.;                  // length of the time interval in minutes
     *best_start = -1;
     *best_end = -1;
-    for (i=0; i<length; i++)
+    if (length <= 0)
     {
-        if (fabs (price_table[GRID][pos] - min) < k_float_compare_eps && *best_start == -1) *best_start = i*60;
-        if (fabs (price_table[GRID][pos] - min) >= k_float_compare_eps && *best_start != -1 && *best_end == -1)
-        {
-            *best_end = i*60;
-            break;
-        }
-        pos++;
-        if (pos == price_table_length[GRID]) pos = 0;     // wrap around
+        *best_end = 0;
+        return;
     }
-    if (*best_end == -1) *best_end = i*60;
+    // The price table is periodic, so if the minimum isn't found within
+    // one period, it won't be found at all. The same holds for the end.
+    int start = find_price (pos, length < n ? length : n, min, true);
+    if (start >= length)
+    {
+        *best_end = length*60;
+        return;
+    }
+    *best_start = start*60;
+    int remaining = length - start - 1;
+    int end = remaining > 0 ? find_price ((pos+start+1) % n, remaining < n ? remaining : n, min, false) : 0;
+    if (end == n || end >= remaining) *best_end = length*60;
+    else *best_end = (start+1+end)*60;
 }
 
 
 double Producer::min_price_in_time_interval (double start_time, double end_time)
 {
-    double min_price = DBL_MAX;
-    int pos = int(start_time/60.) % price_table_length[GRID];  // pos marks an index in the price table
+    int n = price_table_length[GRID];
+    int pos = int(start_time/60.) % n;                         // pos marks an index in the price table
     int length = (end_time - start_time)/60.;                  // length of the time interval in minutes
-    for (int i=0; i<length; i++)
+    if (length <= 0) return DBL_MAX;
+    return min_price_in_range (pos, length < n ? length : n);
+}
+
+
+// Build the sparse tables for the range queries on the grid price table
+
+void Producer::init_price_ranges()
+{
+    const char function_name[] = "Producer::init_price_ranges";
+    int n = price_table_length[GRID];
+
+    range_length = 2*n;
+    range_levels = 1;
+    while ((1 << range_levels) <= n) range_levels++;
+    alloc_memory (&range_min, range_levels*range_length, function_name);
+    alloc_memory (&range_max, range_levels*range_length, function_name);
+    alloc_memory (&range_log, n+1, function_name);
+
+    for (int i=0; i<range_length; i++) range_min[i] = range_max[i] = price_table[GRID][i%n];
+    for (int k=1; k<range_levels; k++)
     {
-        if (min_price > price_table[GRID][pos]) min_price = price_table[GRID][pos];
-        pos++;
-        if (pos == price_table_length[GRID]) pos = 0;     // wrap around
+        double *min_k = range_min + k*range_length, *min_k1 = min_k - range_length;
+        double *max_k = range_max + k*range_length, *max_k1 = max_k - range_length;
+        int half = 1 << (k-1);
+        for (int i=0; i+2*half<=range_length; i++)
+        {
+            min_k[i] = min_k1[i] < min_k1[i+half] ? min_k1[i] : min_k1[i+half];
+            max_k[i] = max_k1[i] > max_k1[i+half] ? max_k1[i] : max_k1[i+half];
+        }
     }
-    return min_price;
+    range_log[0] = 0;
+    range_log[1] = 0;
+    for (int i=2; i<=n; i++) range_log[i] = range_log[i/2] + 1;
 }
 
 
-static int compare_fridges (const void *f1, const void *f2)
+// Minimum of the grid price table for the 'length' minutes starting at minute
+// 'begin' (0 <= begin < price table length, 1 <= length <= price table length)
+
+double Producer::min_price_in_range (int begin, int length)
 {
-    double delta = *(Fridge*)f1 - *(Fridge*)f2;
-    if (delta > 0) return 1;
-    else if (delta < 0) return -1;
-    return 0;
+    int k = range_log[length];
+    double a = range_min[k*range_length + begin];
+    double b = range_min[k*range_length + begin + length - (1 << k)];
+    return a < b ? a : b;
 }
 
-static int compare_freezers (const void *f1, const void *f2)
+
+// Return the offset of the first minute within the range given by 'begin' and
+// 'length', at which the price equals 'min' (at_min == true) or differs from it
+// (at_min == false), 'length' if there is none. 'min' must not be greater than
+// any price in the range. The search jumps over whole blocks of the sparse tables.
+
+int Producer::find_price (int begin, int length, double min, bool at_min)
 {
-    double delta = *(Freezer*)f1 - *(Freezer*)f2;
-    if (delta > 0) return 1;
-    else if (delta < 0) return -1;
-    return 0;
+    int pos = begin, end = begin + length;
+
+    for (int k=range_levels-1; k>=0; k--)
+    {
+        if (pos + (1 << k) > end) continue;
+        bool found = at_min ? fabs (range_min[k*range_length + pos] - min) < k_float_compare_eps
+                            : fabs (range_max[k*range_length + pos] - min) >= k_float_compare_eps;
+        if (!found) pos += 1 << k;
+    }
+    return pos - begin;
 }
+
+
+// The smart fridges and freezers are switched in the order of their temperature.
+// Instead of sorting all of them in every timestep, the list is arranged as a
+// binary heap in O(n) and each pop_heap returns the next appliance in O(log n).
+// Only as many appliances as are actually switched get ordered. The popped ones
+// are moved behind the heap, so that the list stays complete.
+
+template <class AP> static void sift_down (AP **list, int n, int i, HeapOrder order)
+{
+    AP *ap = list[i];
+    int child;
+
+    while ((child = 2*i+1) < n)
+    {
+        if (child+1 < n && order * (*list[child+1] - *list[child]) < 0.) child++;
+        if (order * (*list[child] - *ap) >= 0.) break;
+        list[i] = list[child];
+        i = child;
+    }
+    list[i] = ap;
+}
+
+template <class AP> static void make_heap (AP **list, int n, HeapOrder order)
+{
+    for (int i=n/2-1; i>=0; i--) sift_down (list, n, i, order);
+}
+
+template <class AP> static AP *pop_heap (AP **list, int *n, HeapOrder order)
+{
+    AP *top = list[0];
+
+    (*n)--;
+    list[0] = list[*n];
+    list[*n] = top;
+    sift_down (list, *n, 0, order);
+    return top;
+}
+
+
+#ifdef PARALLEL
+// Sum up the 'finished' flags and the real power of all processes
+// with a single collective operation
+
+static void global_sum (int *finished, double *power_global)
+{
+    double values[2] = {(double)*finished, Household::real_power_total[0]};
+    ProfileScope scope (PROFILE_MPI);
+
+    MPI_Allreduce (MPI_IN_PLACE, values, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    *finished = (int)values[0];
+    *power_global = values[1];
+}
+
+
+// Switches the smartgrid enabled fridges or freezers of all processes in the
+// given order, until the global load has changed by 'excess'. Rather than
+// switching one appliance after another with a global sum in between, the
+// processes agree on a cutoff temperature first: the remaining candidates are
+// split at the mean of their keys, and one reduction per round tells which
+// part contains the cutoff. Locally, the list is partitioned
+// like in a quickselect, so the number of rounds and the work per process are
+// both about logarithmic. Appliances of the same temperature at the cutoff
+// are switched together. The return value is the global change of the load.
+
+template <class AP> static double switch_globally (AP **list, int n, HeapOrder order, double excess)
+{
+    double sum[6], w_lo = 0., pivot, key;
+    int a = 0, b = 0, m, i;
+    AP *swap;
+
+    if (excess <= 0.) return 0.;
+
+    // The candidates, which would actually change their state, are moved to
+    // the front of the list. The candidates in [0,a) are switched in any case, the
+    // cutoff lies within [a,b).
+    for (i=0; i<n; i++)
+    {
+        if (order == COLDEST ? list[i]->can_turn_off() : list[i]->can_turn_on())
+        {
+            swap = list[b]; list[b] = list[i]; list[i] = swap;
+            b++;
+        }
+    }
+    sum[0] = sum[1] = sum[2] = 0.;
+    for (i=0; i<b; i++)
+    {
+        sum[0] += list[i]->power.real;
+        sum[1] += 1.;
+        sum[2] += order * list[i]->get_temperature();
+    }
+    Profiler::start (PROFILE_MPI);
+    MPI_Allreduce (MPI_IN_PLACE, sum, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    Profiler::stop (PROFILE_MPI);
+
+    if (sum[0] > excess)
+    {
+        while (sum[1] > 1.)
+        {
+            pivot = sum[2] / sum[1];
+            m = a;
+            for (i=a; i<b; i++)
+            {
+                if (order * list[i]->get_temperature() <= pivot)
+                {
+                    swap = list[m]; list[m] = list[i]; list[i] = swap;
+                    m++;
+                }
+            }
+            sum[0] = sum[1] = sum[2] = sum[3] = sum[4] = sum[5] = 0.;
+            for (i=a; i<b; i++)
+            {
+                key = order * list[i]->get_temperature();
+                if (i < m)
+                {
+                    sum[0] += list[i]->power.real;
+                    sum[1] += 1.;
+                    sum[2] += key;
+                }
+                else
+                {
+                    sum[3] += list[i]->power.real;
+                    sum[4] += 1.;
+                    sum[5] += key;
+                }
+            }
+            Profiler::start (PROFILE_MPI);
+            MPI_Allreduce (MPI_IN_PLACE, sum, 6, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+            Profiler::stop (PROFILE_MPI);
+            if (sum[1] == 0. || sum[4] == 0.)  // the keys cannot be separated any further
+            {
+                sum[0] += sum[3];
+                break;
+            }
+            if (w_lo + sum[0] >= excess) b = m;  // the cutoff is <= pivot
+            else
+            {
+                w_lo += sum[0];
+                a = m;
+                sum[0] = sum[3];
+                sum[1] = sum[4];
+                sum[2] = sum[5];
+            }
+        }
+    }
+    for (i=0; i<b; i++)
+    {
+        if (order == COLDEST) list[i]->turn_off();
+        else list[i]->turn_on();
+    }
+    return w_lo + sum[0];
+}
+#endif
@@ -0,0 +1,275 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <chrono>
+#ifdef PARALLEL
+#include <mpi.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "constants.H"
+#include "configuration.H"
+#include "profiler.H"
+#include "proto.H"
+#include "globals.H"
+
+
+bool Profiler::enabled = false;
+bool Profiler::simulating = false;
+double Profiler::start_time[NUM_PROFILE_PHASES];
+double Profiler::total[NUM_PROFILE_PHASES];
+double Profiler::today[NUM_PROFILE_PHASES];
+FILE *Profiler::timeline_fp = NULL;
+
+// Names in the summary (indented if contained in the phase above) and
+// column headers in the timeline and the table of the processes
+static const char *const k_phase_names[NUM_PROFILE_PHASES][2] =
+{
+    {"Pre-simulation runs",          "prerun"},
+    {"  Household, 1st pass",        "prerun_1st_pass"},
+    {"  Household, 2nd pass",        "prerun_2nd_pass"},
+    {"  Household, 3rd pass",        "prerun_3rd_pass"},
+    {"Simulation",                   "simulation"},
+    {"  Location::update_values",    "location"},
+    {"  Household, 1st pass",        "1st_pass"},
+    {"  Household, 2nd pass",        "2nd_pass"},
+    {"  Household, 3rd pass",        "3rd_pass"},
+    {"  Producer::simulate",         "producer"},
+    {"  Powerflow::simulate",        "powerflow"},
+    {"    input file",               "pf_input"},
+    {"    solver",                   "pf_solver"},
+    {"    results",                  "pf_results"},
+    {"  Output::print",              "output"},
+    {"  Output::print_households",   "households"},
+    {"  Output::print_consumption",  "consumption"},
+    {"  costs, heat consumption",    "costs"},
+    {"  Output::print_distribution", "distribution"},
+    {"  Output::print_summary",      "summary"},
+    {"  Output::print_max",          "max"},
+    {"  checkpoints",                "checkpoint"},
+    {"  MPI collectives",            "mpi"}
+};
+
+
+double Profiler::now()
+{
+    return std::chrono::duration<double> (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Reset all timers. With config->profiling == 2 the timeline (one line per
+// simulated day) is written to 'run_times.timeline'.
+
+void Profiler::init()
+{
+    enabled = config->profiling > 0;
+    simulating = false;
+    for (int i=0; i<NUM_PROFILE_PHASES; i++) total[i] = today[i] = 0.;
+    if (timeline_fp) fclose (timeline_fp);
+    timeline_fp = NULL;
+    if (config->profiling == 2 && rank == 0)
+    {
+        open_file (&timeline_fp, "run_times.timeline", "w");
+        fprintf (timeline_fp, "# Run time [s] per simulated day (day 0: pre-simulation runs), maximum over all processes\n");
+        fprintf (timeline_fp, "# day");
+        for (int i=0; i<NUM_PROFILE_PHASES; i++) fprintf (timeline_fp, " %s", k_phase_names[i][1]);
+        fprintf (timeline_fp, "\n");
+    }
+}
+
+
+// Only the master thread measures the time. The other threads of a parallel
+// region, e.g. in Household::simulate, meet it at the barrier at the end of
+// each pass. The parts of the main simulation are left out, if they are called
+// by the pre-simulation runs (e.g. Location::update_values), so that they add
+// up to no more than the simulation.
+
+void Profiler::start (ProfilePhase phase)
+{
+    if (!enabled) return;
+#ifdef _OPENMP
+    if (omp_get_thread_num()) return;
+#endif
+    if (phase == PROFILE_SIMULATION) simulating = true;
+    else if (phase > PROFILE_SIMULATION && !simulating) return;
+    start_time[phase] = now();
+}
+
+
+void Profiler::stop (ProfilePhase phase)
+{
+    if (!enabled) return;
+#ifdef _OPENMP
+    if (omp_get_thread_num()) return;
+#endif
+    if (phase == PROFILE_SIMULATION) simulating = false;
+    else if (phase > PROFILE_SIMULATION && !simulating) return;
+    double elapsed = now() - start_time[phase];
+    total[phase] += elapsed;
+    today[phase] += elapsed;
+}
+
+
+// Add the line for the simulated day 'day' to the timeline (called by all processes)
+
+void Profiler::end_of_day (int day)
+{
+    if (!enabled || config->profiling < 2) return;
+#ifdef PARALLEL
+    if (rank == 0)
+        MPI_Reduce (MPI_IN_PLACE, today, NUM_PROFILE_PHASES, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    else
+        MPI_Reduce (today, today, NUM_PROFILE_PHASES, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+#endif
+    if (rank == 0)
+    {
+        fprintf (timeline_fp, "%d", day);
+        for (int i=0; i<NUM_PROFILE_PHASES; i++) fprintf (timeline_fp, " %.4lf", today[i]);
+        fprintf (timeline_fp, "\n");
+    }
+    for (int i=0; i<NUM_PROFILE_PHASES; i++) today[i] = 0.;
+}
+
+
+// Peak resident set size [MB] of the calling process (0, if unknown)
+
+double Profiler::peak_rss()
+{
+#ifdef _WIN32
+    return 0.;
+#else
+    struct rusage usage;
+    if (getrusage (RUSAGE_SELF, &usage)) return 0.;
+#ifdef __APPLE__
+    return usage.ru_maxrss/1048576.;    // bytes
+#else
+    return usage.ru_maxrss/1024.;       // kilobytes
+#endif
+#endif
+}
+
+
+// Write the run time of each phase to the file 'run_times': the minimum, average
+// and maximum over all processes and the times of each process. Phases which
+// didn't occur are left out. The last column of the table of the processes is
+// their peak resident set size.
+
+void Profiler::report()
+{
+    double *times = NULL, *rss = NULL, min[NUM_PROFILE_PHASES], avg[NUM_PROFILE_PHASES], max[NUM_PROFILE_PHASES];
+    double local_rss = peak_rss(), min_rss, avg_rss = 0., max_rss;
+    FILE *fp = NULL;
+    int threads = 1;
+
+    if (!enabled) return;
+    if (rank == 0)
+    {
+        alloc_memory (&times, num_processes*NUM_PROFILE_PHASES, "Profiler::report");
+        alloc_memory (&rss, num_processes, "Profiler::report");
+    }
+#ifdef PARALLEL
+    MPI_Gather (total, NUM_PROFILE_PHASES, MPI_DOUBLE, times, NUM_PROFILE_PHASES, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather (&local_rss, 1, MPI_DOUBLE, rss, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#else
+    for (int i=0; i<NUM_PROFILE_PHASES; i++) times[i] = total[i];
+    rss[0] = local_rss;
+#endif
+    if (rank == 0)
+    {
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#endif
+        for (int i=0; i<NUM_PROFILE_PHASES; i++)
+        {
+            min[i] = max[i] = times[i];
+            avg[i] = 0.;
+            for (int p=0; p<num_processes; p++)
+            {
+                double t = times[p*NUM_PROFILE_PHASES+i];
+                if (t < min[i]) min[i] = t;
+                if (t > max[i]) max[i] = t;
+                avg[i] += t/num_processes;
+            }
+        }
+        min_rss = max_rss = rss[0];
+        for (int p=0; p<num_processes; p++)
+        {
+            if (rss[p] < min_rss) min_rss = rss[p];
+            if (rss[p] > max_rss) max_rss = rss[p];
+            avg_rss += rss[p]/num_processes;
+        }
+        open_file (&fp, "run_times", "w");
+        fprintf (fp, "Run time [s] of %d process(es) with %d thread(s) each\n\n", num_processes, threads);
+        fprintf (fp, "%-32s %12s %12s %12s %8s\n", "Phase", "Min", "Avg", "Max", "Max/Avg");
+        fprintf (fp, "-------------------------------------------------------------------------------\n");
+        for (int i=0; i<NUM_PROFILE_PHASES; i++)
+        {
+            if (max[i] == 0.) continue;
+            fprintf (fp, "%-32s %12.3lf %12.3lf %12.3lf %8.2lf\n", k_phase_names[i][0], min[i], avg[i], max[i], max[i]/avg[i]);
+        }
+        fprintf (fp, "-------------------------------------------------------------------------------\n");
+        if (max_rss > 0.)
+        {
+            fprintf (fp, "%-32s %12.1lf %12.1lf %12.1lf %8.2lf\n", "Peak resident set size [MB]", min_rss, avg_rss, max_rss, max_rss/avg_rss);
+        }
+        fprintf (fp, "\n\nRun time [s] per process\n\n%-8s", "rank");
+        for (int i=0; i<NUM_PROFILE_PHASES; i++) if (max[i] > 0.) fprintf (fp, " %12s", k_phase_names[i][1]);
+        fprintf (fp, " %12s\n", "rss_mb");
+        for (int p=0; p<num_processes; p++)
+        {
+            fprintf (fp, "%-8d", p);
+            for (int i=0; i<NUM_PROFILE_PHASES; i++) if (max[i] > 0.) fprintf (fp, " %12.3lf", times[p*NUM_PROFILE_PHASES+i]);
+            fprintf (fp, " %12.1lf\n", rss[p]);
+        }
+        fclose (fp);
+        delete [] times;
+        delete [] rss;
+        if (timeline_fp) fclose (timeline_fp);
+        timeline_fp = NULL;
+    }
+}
@@ -41,41 +41,125 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdlib.h>
 #include <time.h>
-#ifdef _WIN32
-#   define random rand
-#   define srandom srand
+#ifdef PARALLEL
+#include <mpi.h>
 #endif
 
 #include "proto.H"
 #include "globals.H"
 #include "constants.H"
 
+#define k_random_max 2147483647     // largest value returned by next_random()
+
+static uint32_t seed_value = 0;
+static RandomStream global_stream = {{0, 0}, 0, {0, 0, 0, 0}, 4};  // used for everything that does not belong to a household
+static thread_local RandomStream *current_stream = &global_stream;
+
+
+// Philox4x32-10 from Salmon et al., "Parallel random numbers: as easy as 1, 2, 3" (SC11).
+// Encrypts the counter of the stream with its key and stores the result in the block.
+
+static void philox (RandomStream *stream)
+{
+    uint32_t c[4], k[2];
+    uint64_t p0, p1;
+
+    c[0] = (uint32_t)stream->counter;
+    c[1] = (uint32_t)(stream->counter >> 32);
+    c[2] = 0;
+    c[3] = 0;
+    k[0] = stream->key[0];
+    k[1] = stream->key[1];
+    for (int round=0; round<10; round++)
+    {
+        p0 = (uint64_t)0xD2511F53 * c[0];
+        p1 = (uint64_t)0xCD9E8D57 * c[2];
+        c[0] = (uint32_t)(p1 >> 32) ^ c[1] ^ k[0];
+        c[1] = (uint32_t)p1;
+        c[2] = (uint32_t)(p0 >> 32) ^ c[3] ^ k[1];
+        c[3] = (uint32_t)p0;
+        k[0] += 0x9E3779B9;
+        k[1] += 0xBB67AE85;
+    }
+    for (int i=0; i<4; i++) stream->block[i] = c[i];
+    stream->counter++;
+    stream->pos = 0;
+}
+
+
+// Returns a random number between 0 and k_random_max, just like random()
+
+static long next_random()
+{
+    RandomStream *stream = current_stream;
+    if (stream->pos == 4) philox (stream);
+    return (long)(stream->block[stream->pos++] >> 1);
+}
+
+
+void init_random_stream (RandomStream *stream, int stream_number)
+{
+    stream->key[0] = seed_value;
+    stream->key[1] = (uint32_t)stream_number;
+    stream->counter = 0;
+    stream->pos = 4;
+}
+
+
+// All random numbers drawn by the calling thread are taken from 'stream'.
+// With stream = NULL we switch back to the global stream.
+
+void select_random_stream (RandomStream *stream)
+{
+    current_stream = stream ? stream : &global_stream;
+}
+
+
+// The seed and the state of the global stream are part of a checkpoint.
+// The streams of the households are stored with the households.
+
+void get_random_state (uint32_t *seed, RandomStream *stream)
+{
+    *seed = seed_value;
+    *stream = global_stream;
+}
+
+
+// With stream = NULL the global stream starts from the beginning
+
+void set_random_state (uint32_t seed, const RandomStream *stream)
+{
+    seed_value = seed;
+    if (stream) global_stream = *stream;
+    else init_random_stream (&global_stream, 0);
+}
+
 
 int get_random_number (int min, int max)
 {
-    return random() % (max - min + 1) + min;
+    return next_random() % (max - min + 1) + min;
 }
 
 double get_random_number (double min, double max)
 {
-    return (max - min)*(double)random()/(double)RAND_MAX + min;
+    return (max - min)*(double)next_random()/(double)k_random_max + min;
 }
 
 double normal_distributed_random (int mean, int sigma)
 {
     double u1, u2, q, ndr;
-    double factor = 1./(double)(RAND_MAX);
+    double factor = 1./(double)(k_random_max);
 
     // Polar method from George Marsaglia. u1 and u2 are uniformly
     // distributed in the interval [-1,1]
 
-    u1 = 2 * ((double)random()*factor) - 1;
-    u2 = 2 * ((double)random()*factor) - 1;
+    u1 = 2 * ((double)next_random()*factor) - 1;
+    u2 = 2 * ((double)next_random()*factor) - 1;
     q = u1*u1 + u2*u2;
     while (q == 0. || q > 1.)
     {
-        u1 = 2 * ((double)random()*factor) - 1;
-        u2 = 2 * ((double)random()*factor) - 1;
+        u1 = 2 * ((double)next_random()*factor) - 1;
+        u2 = 2 * ((double)next_random()*factor) - 1;
         q = u1*u1 + u2*u2;
     }
     ndr = sqrt (-2.*log(q)/q) * u1;
@@ -93,20 +177,20 @@ double normal_distributed_random_with_limits (double mean, double sigma,
                                               double lower, double upper)
 {
     double u1, u2, q, ndr=0.;
-    double factor = 1./(double)(RAND_MAX);
+    double factor = 1./(double)(k_random_max);
 
     // Polar method from George Marsaglia. u1 and u2 are uniformly
     // distributed in the interval [-1,1]
 
     while (ndr < lower || ndr > upper)
     {
-        u1 = 2 * ((double)random()*factor) - 1;
-        u2 = 2 * ((double)random()*factor) - 1;
+        u1 = 2 * ((double)next_random()*factor) - 1;
+        u2 = 2 * ((double)next_random()*factor) - 1;
         q = u1*u1 + u2*u2;
         while (q == 0. || q > 1.)
         {
-            u1 = 2 * ((double)random()*factor) - 1;
-            u2 = 2 * ((double)random()*factor) - 1;
+            u1 = 2 * ((double)next_random()*factor) - 1;
+            u2 = 2 * ((double)next_random()*factor) - 1;
             q = u1*u1 + u2*u2;
         }
         ndr = sqrt (-2.*log(q)/q) * u1;
@@ -169,6 +253,15 @@ void init_random()
     fclose (fp);
     free (line);
 
-    if (config->seed == 0) srandom ((unsigned)(time(NULL)+rank));
-    else srandom ((unsigned)config->seed);
+    // All processes have to use the same seed, otherwise a household's
+    // random numbers would depend on the process it belongs to
+    if (config->seed == 0)
+    {
+        seed_value = (uint32_t)time(NULL);
+#ifdef PARALLEL
+        MPI_Bcast (&seed_value, 1, MPI_UINT32_T, 0, MPI_COMM_WORLD);
+#endif
+    }
+    else seed_value = (uint32_t)config->seed;
+    init_random_stream (&global_stream, 0);
 }
@@ -59,7 +59,6 @@ SolarModule::SolarModule (class Household *hh)
         {
             real_power_total[i] = 0.;
             reactive_power_total[i] = 0.;
-            apparent_power_total[i] = 0.;
         }
     }
     household = hh;
@@ -112,9 +111,7 @@ void SolarModule::simulate()
 
         reactive_power_total[0] += power.reactive;
         reactive_power_total[r] += power.reactive;
-
-        apparent_power_total[0] = sqrt (real_power_total[0]*real_power_total[0] + reactive_power_total[0]*reactive_power_total[0]);
-        apparent_power_total[r] = sqrt (real_power_total[r]*real_power_total[r] + reactive_power_total[r]*reactive_power_total[r]);
+        // the apparent power is calculated by the Output class
     }
 }
 
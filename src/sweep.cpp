@@ -0,0 +1,280 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "globals.H"
+#include "proto.H"
+#include "types.H"
+#include "powerflow.H"
+
+// A backward/forward sweep solver for radial grids. The buses are visited in
+// breadth first order starting at the reference bus, i.e. the tree discovered
+// here is the same which Powerflow::connect() walks from the transformers.
+// The backward sweep accumulates the currents drawn by the loads from the
+// leaves towards the root, the forward sweep updates the voltages from the root
+// towards the leaves. Each sweep takes time proportional to the number of buses.
+// Grids with loops, parallel branches or PV buses are left to the Newton-Raphson
+// solver, which also provides the bus admittance data used here.
+
+const double k_sweep_tolerance = 1e-10;   // max. change of a voltage [p.u.] in the last sweep
+const int k_sweep_max_iterations = 100;
+
+
+void Powerflow::init_sweep()
+{
+    const char function_name[] = "Powerflow::init_sweep";
+    int i, k, n = num_buses;
+    int num_ref = 0, num_pv = 0;
+
+    alloc_memory (&sweep.node, n, function_name);
+    alloc_memory (&sweep.parent, n, function_name);
+    alloc_memory (&sweep.y_node, 8*n, function_name);
+    alloc_memory (&sweep.v_re, n, function_name);
+    alloc_memory (&sweep.v_im, n, function_name);
+    alloc_memory (&sweep.j_re, n, function_name);
+    alloc_memory (&sweep.j_im, n, function_name);
+    sweep.num_nodes = 0;
+
+    for (i=0; i<n; i++)
+    {
+        if (newton.type[i] == REF) num_ref++;
+        else if (newton.type[i] == PV) num_pv++;
+    }
+    sweep.radial = num_ref == 1 && num_pv == 0;
+
+    // Lists of the branches in service at each bus
+    int *adj_start, *adj_branch, *position;
+    alloc_memory (&adj_start, n+1, function_name);
+    alloc_memory (&position, n, function_name);
+    for (i=0; i<=n; i++) adj_start[i] = 0;
+    for (k=0; k<num_branches; k++)
+    {
+        if (branch[k].status <= 0) continue;
+        adj_start[branch[k].from]++;
+        adj_start[branch[k].to]++;
+    }
+    for (i=0; i<n; i++) adj_start[i+1] += adj_start[i];
+    alloc_memory (&adj_branch, adj_start[n] > 0 ? adj_start[n] : 1, function_name);
+    for (k=0; k<num_branches; k++)
+    {
+        if (branch[k].status <= 0) continue;
+        adj_branch[adj_start[branch[k].from-1]++] = k;
+        adj_branch[adj_start[branch[k].to-1]++] = k;
+    }
+    for (i=n; i>0; i--) adj_start[i] = adj_start[i-1];
+    adj_start[0] = 0;
+
+    // Breadth first search from the reference bus. The parent of node 'pos'
+    // is stored as a position in the node list as well. Meeting a bus a second
+    // time means that the grid contains a loop.
+    for (i=0; i<n; i++) position[i] = -1;
+    if (sweep.radial)
+    {
+        for (i=0; newton.type[i] != REF; i++);
+        sweep.node[0] = i;
+        sweep.parent[0] = -1;
+        position[i] = 0;
+        sweep.num_nodes = 1;
+        int *parent_branch;
+        alloc_memory (&parent_branch, n, function_name);
+        parent_branch[0] = -1;
+        for (int pos=0; pos<sweep.num_nodes && sweep.radial; pos++)
+        {
+            int b = sweep.node[pos];
+            for (int a=adj_start[b]; a<adj_start[b+1]; a++)
+            {
+                k = adj_branch[a];
+                if (k == parent_branch[pos]) continue;
+                int c = branch[k].from-1 == b ? branch[k].to-1 : branch[k].from-1;
+                if (position[c] >= 0)
+                {
+                    sweep.radial = false;
+                    break;
+                }
+                position[c] = sweep.num_nodes;
+                sweep.node[sweep.num_nodes] = c;
+                sweep.parent[sweep.num_nodes] = pos;
+                parent_branch[sweep.num_nodes] = k;
+                sweep.num_nodes++;
+            }
+        }
+        // Buses not reached from the reference bus are acceptable only if they are out of service
+        for (i=0; i<n && sweep.radial; i++)
+        {
+            if (position[i] < 0 && newton.type[i] != NONE) sweep.radial = false;
+        }
+
+        // The two-port admittances of the branch to the parent, seen from the child:
+        // y_node = (Ycc, Ycp, Ypp, Ypc), each as real and imaginary part
+        for (int pos=1; pos<sweep.num_nodes && sweep.radial; pos++)
+        {
+            const double *y = newton.y_branch + 8*parent_branch[pos];
+            double *yn = sweep.y_node + 8*pos;
+            if (branch[parent_branch[pos]].to-1 == sweep.node[pos])
+            {
+                yn[0] = y[6]; yn[1] = y[7];  // Ytt
+                yn[2] = y[4]; yn[3] = y[5];  // Ytf
+                yn[4] = y[0]; yn[5] = y[1];  // Yff
+                yn[6] = y[2]; yn[7] = y[3];  // Yft
+            }
+            else
+            {
+                yn[0] = y[0]; yn[1] = y[1];  // Yff
+                yn[2] = y[2]; yn[3] = y[3];  // Yft
+                yn[4] = y[6]; yn[5] = y[7];  // Ytt
+                yn[6] = y[4]; yn[7] = y[5];  // Ytf
+            }
+        }
+        delete [] parent_branch;
+    }
+    delete [] adj_start;
+    delete [] adj_branch;
+    delete [] position;
+
+    if (!sweep.radial)
+    {
+        printf ("\nNOTE: The power flow case is not a radial grid with a single reference bus and no PV buses.\n");
+        printf ("      The Newton-Raphson solver is used instead of the backward/forward sweep.\n\n");
+    }
+}
+
+
+void Powerflow::delete_sweep()
+{
+    delete [] sweep.node;
+    delete [] sweep.parent;
+    delete [] sweep.y_node;
+    delete [] sweep.v_re;
+    delete [] sweep.v_im;
+    delete [] sweep.j_re;
+    delete [] sweep.j_im;
+}
+
+
+// Solve the power flow by backward/forward sweeps. On success the voltages are
+// stored in newton.v_mag and newton.v_ang, otherwise they remain unchanged.
+
+bool Powerflow::solve_sweep()
+{
+    int pos, iteration;
+    const int num_nodes = sweep.num_nodes;
+    const int *node = sweep.node, *parent = sweep.parent;
+    double *v_re = sweep.v_re, *v_im = sweep.v_im;
+    double *j_re = sweep.j_re, *j_im = sweep.j_im;
+
+    update_injections();
+
+    // Start from the voltages of the previous call
+    for (pos=0; pos<num_nodes; pos++)
+    {
+        int b = node[pos];
+        v_re[pos] = newton.v_mag[b] * cos (newton.v_ang[b]);
+        v_im[pos] = newton.v_mag[b] * sin (newton.v_ang[b]);
+    }
+
+    for (iteration=0; iteration<k_sweep_max_iterations; iteration++)
+    {
+        // Current drawn at each bus by the loads and the shunt:
+        // J = conj(S/V) + Ysh V,  with the consumed power S = -(p_spec + j q_spec)
+        for (pos=0; pos<num_nodes; pos++)
+        {
+            int b = node[pos];
+            double p = -newton.p_spec[b], q = -newton.q_spec[b];
+            double gs = bus[b].Gs / baseMVA, bs = bus[b].Bs / baseMVA;
+            double vr = v_re[pos], vi = v_im[pos];
+            double v2 = vr*vr + vi*vi;
+            j_re[pos] = (p*vr + q*vi) / v2 + gs*vr - bs*vi;
+            j_im[pos] = (p*vi - q*vr) / v2 + gs*vi + bs*vr;
+        }
+
+        // Backward sweep: The branch to the parent carries the current of the whole
+        // subtree. From the child's end (current Ic = -J into the branch, voltage Vc)
+        // follows the voltage at the parent's end Vp = (Ic - Ycc Vc) / Ycp and with it
+        // the current into the branch at the parent's end Ip = Ypp Vp + Ypc Vc.
+        for (pos=num_nodes-1; pos>0; pos--)
+        {
+            const double *y = sweep.y_node + 8*pos;
+            double ir = -j_re[pos], ii = -j_im[pos];
+            double vr = v_re[pos], vi = v_im[pos];
+            double nr = ir - (y[0]*vr - y[1]*vi);
+            double ni = ii - (y[0]*vi + y[1]*vr);
+            double d = y[2]*y[2] + y[3]*y[3];
+            double pr = (nr*y[2] + ni*y[3]) / d;
+            double pi = (ni*y[2] - nr*y[3]) / d;
+            j_re[parent[pos]] += y[4]*pr - y[5]*pi + y[6]*vr - y[7]*vi;
+            j_im[parent[pos]] += y[4]*pi + y[5]*pr + y[6]*vi + y[7]*vr;
+        }
+
+        // Forward sweep: Vc = (Ic - Ycp Vp) / Ycc
+        double change = 0.;
+        for (pos=1; pos<num_nodes; pos++)
+        {
+            const double *y = sweep.y_node + 8*pos;
+            double vpr = v_re[parent[pos]], vpi = v_im[parent[pos]];
+            double nr = -j_re[pos] - (y[2]*vpr - y[3]*vpi);
+            double ni = -j_im[pos] - (y[2]*vpi + y[3]*vpr);
+            double d = y[0]*y[0] + y[1]*y[1];
+            double vr = (nr*y[0] + ni*y[1]) / d;
+            double vi = (ni*y[0] - nr*y[1]) / d;
+            double e = fabs (vr-v_re[pos]) + fabs (vi-v_im[pos]);
+            if (e > change || e != e) change = e;  // e != e catches NaN
+            v_re[pos] = vr;
+            v_im[pos] = vi;
+        }
+        if (change != change) return false;
+        if (change < k_sweep_tolerance) break;
+    }
+    if (iteration == k_sweep_max_iterations) return false;
+
+    for (pos=1; pos<num_nodes; pos++)
+    {
+        int b = node[pos];
+        newton.v_mag[b] = sqrt (v_re[pos]*v_re[pos] + v_im[pos]*v_im[pos]);
+        newton.v_ang[b] = atan2 (v_im[pos], v_re[pos]);
+    }
+    calc_injections();
+    return true;
+}
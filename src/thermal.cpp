@@ -0,0 +1,594 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+
+#include "element.H"
+#include "appliance.H"
+#include "household.H"
+#include "thermal.H"
+#include "proto.H"
+#include "globals.H"
+
+
+ThermalBatch* ThermalBatch::batch = NULL;
+int ThermalBatch::num_batches = 0;
+int ThermalBatch::max_nodes = 0;
+int ThermalBatch::num_tasks = 0;
+int* ThermalBatch::task_batch = NULL;
+int* ThermalBatch::task_chunk = NULL;
+
+static const int K = k_thermal_lanes;
+static const double delta_t = 3600.;     // timestep size of the thermal model in seconds
+
+
+ThermalBatch::ThermalBatch()
+{
+    num_lanes = num_chunks = num_elements = num_nodes = 0;
+    first_node = household = NULL;
+    c_int = area_tot = unit_air = unit_op = schur = NULL;
+    area = area_hci = h_ci = h_ri = h_ext = phi_sky = NULL;
+    h = kappa = inv_pivot = response = temp_prev = unit_temp = NULL;
+}
+
+
+ThermalBatch::~ThermalBatch()
+{
+    delete [] first_node;
+    delete [] household;
+    delete [] c_int;
+    delete [] area_tot;
+    delete [] unit_air;
+    delete [] unit_op;
+    delete [] schur;
+    delete [] area;
+    delete [] area_hci;
+    delete [] h_ci;
+    delete [] h_ri;
+    delete [] h_ext;
+    delete [] phi_sky;
+    delete [] h;
+    delete [] kappa;
+    delete [] inv_pivot;
+    delete [] response;
+    delete [] temp_prev;
+    delete [] unit_temp;
+}
+
+
+bool ThermalBatch::same_topology (const Household *h1, const Household *h2)
+{
+    if (h1->num_elements != h2->num_elements) return false;
+    for (int i=0; i<h1->num_elements; i++)
+    {
+        if (h1->elements[i]->num_nodes != h2->elements[i]->num_nodes) return false;
+    }
+    return true;
+}
+
+
+// Sort the households into batches of the same topology. The chunks
+// of all batches are distributed among the threads.
+
+void ThermalBatch::setup()
+{
+    const char function_name[] = "ThermalBatch::setup";
+    const int num_hh = Household::local_count;
+    int *batch_of, *first_hh, *hh_index;
+    int b, n;
+
+    alloc_memory (&batch_of, num_hh, function_name);
+    alloc_memory (&first_hh, num_hh, function_name);
+    alloc_memory (&hh_index, num_hh, function_name);
+    num_batches = 0;
+    for (int i=0; i<num_hh; i++)
+    {
+        for (b=0; b<num_batches; b++)
+        {
+            if (same_topology (Household::hh+i, Household::hh+first_hh[b])) break;
+        }
+        if (b == num_batches) first_hh[num_batches++] = i;
+        batch_of[i] = b;
+    }
+    alloc_memory (&batch, num_batches, function_name);
+    num_tasks = 0;
+    max_nodes = 0;
+    for (b=0; b<num_batches; b++)
+    {
+        n = 0;
+        for (int i=0; i<num_hh; i++)
+        {
+            if (batch_of[i] == b) hh_index[n++] = i;
+        }
+        batch[b].init (n, hh_index);
+        num_tasks += batch[b].num_chunks;
+        if (batch[b].num_nodes > max_nodes) max_nodes = batch[b].num_nodes;
+    }
+    alloc_memory (&task_batch, num_tasks, function_name);
+    alloc_memory (&task_chunk, num_tasks, function_name);
+    n = 0;
+    for (b=0; b<num_batches; b++)
+    {
+        for (int c=0; c<batch[b].num_chunks; c++)
+        {
+            task_batch[n] = b;
+            task_chunk[n] = c;
+            n++;
+        }
+    }
+    delete [] batch_of;
+    delete [] first_hh;
+    delete [] hh_index;
+}
+
+
+// Once the batches are set up, the node temperatures of the building elements
+// are no longer up to date. Copy them back, e.g. before they are stored in a
+// checkpoint. A restarted simulation sets up the batches from the elements.
+
+void ThermalBatch::store_temperatures()
+{
+    for (int b=0; b<num_batches; b++)
+    {
+        const ThermalBatch *tb = batch+b;
+        for (int lane=0; lane<tb->num_lanes; lane++)
+        {
+            const int c = lane / K;
+            const int l = lane % K;
+            const Household *hp = Household::hh + tb->household[lane];
+            for (int e=0; e<tb->num_elements; e++)
+            {
+                Element *el = hp->elements[e];
+                for (int j=0; j<el->num_nodes; j++)
+                {
+                    el->node_temp_prev[j] = tb->temp_prev[(c*tb->num_nodes + tb->first_node[e] + j)*K + l];
+                }
+            }
+        }
+    }
+}
+
+
+void ThermalBatch::deallocate_memory()
+{
+    delete [] batch;
+    delete [] task_batch;
+    delete [] task_chunk;
+    batch = NULL;
+    task_batch = task_chunk = NULL;
+    num_batches = num_tasks = max_nodes = 0;
+}
+
+
+// Solve the tridiagonal system of an element chain with m nodes for n lanes in place.
+// x holds the right-hand side on entry. The pointers point to the first node of the
+// chain. The lower LU factors -h[j-1]*inv_pivot[j-1] are not stored.
+
+static void solve_chain (double *x, const double *inv_pivot, const double *h, int m, int n)
+{
+    for (int j=1; j<m; j++)
+    {
+#pragma omp simd
+        for (int l=0; l<n; l++) x[j*K+l] += h[(j-1)*K+l] * inv_pivot[(j-1)*K+l] * x[(j-1)*K+l];
+    }
+#pragma omp simd
+    for (int l=0; l<n; l++) x[(m-1)*K+l] *= inv_pivot[(m-1)*K+l];
+    for (int j=m-2; j>=0; j--)
+    {
+#pragma omp simd
+        for (int l=0; l<n; l++) x[j*K+l] = (x[j*K+l] + h[j*K+l]*x[(j+1)*K+l]) * inv_pivot[j*K+l];
+    }
+}
+
+
+// Copy the building elements of the households into the batch and set up the
+// system matrices. They don't change, so this has to be done only once.
+
+void ThermalBatch::init (int num_hh, const int hh_index[])
+{
+    const char function_name[] = "ThermalBatch::init";
+    const double kappa_int = 10000.;          // ISO 52016-1 table B.12
+    const Household *hp = Household::hh + hh_index[0];
+    const Element *el;
+    double diag, sum_area_hci, r_0;
+    int e, j, k, m, c, l, n;
+
+    num_lanes = num_hh;
+    num_chunks = (num_lanes + K - 1) / K;
+    num_elements = hp->num_elements;
+    alloc_memory (&first_node, num_elements+1, function_name);
+    first_node[0] = 0;
+    for (e=0; e<num_elements; e++) first_node[e+1] = first_node[e] + hp->elements[e]->num_nodes;
+    num_nodes = first_node[num_elements];
+
+    alloc_memory (&household, num_lanes, function_name);
+    alloc_memory (&c_int, num_lanes, function_name);
+    alloc_memory (&area_tot, num_lanes, function_name);
+    alloc_memory (&schur, num_chunks*4*K, function_name);
+    alloc_memory (&area, num_chunks*num_elements*K, function_name);
+    alloc_memory (&area_hci, num_chunks*num_elements*K, function_name);
+    alloc_memory (&h_ci, num_chunks*num_elements*K, function_name);
+    alloc_memory (&h_ri, num_chunks*num_elements*K, function_name);
+    alloc_memory (&h_ext, num_chunks*num_elements*K, function_name);
+    alloc_memory (&phi_sky, num_chunks*num_elements*K, function_name);
+    alloc_memory (&h, num_chunks*num_nodes*K, function_name);
+    alloc_memory (&kappa, num_chunks*num_nodes*K, function_name);
+    alloc_memory (&inv_pivot, num_chunks*num_nodes*K, function_name);
+    alloc_memory (&response, num_chunks*num_nodes*K, function_name);
+    alloc_memory (&temp_prev, num_chunks*num_nodes*K, function_name);
+
+    for (int lane=0; lane<num_lanes; lane++)
+    {
+        c = lane / K;
+        l = lane % K;
+        household[lane] = hh_index[lane];
+        hp = Household::hh + hh_index[lane];
+        c_int[lane] = hp->area * kappa_int / delta_t;
+        area_tot[lane] = hp->area_tot;
+        for (e=0; e<num_elements; e++)
+        {
+            el = hp->elements[e];
+            k = (c*num_elements + e)*K + l;
+            area[k] = el->area;
+            area_hci[k] = el->area * el->h_ci;
+            h_ci[k] = el->h_ci;
+            h_ri[k] = el->h_ri;
+            h_ext[k] = el->h_ce + el->h_re;
+            phi_sky[k] = el->phi_sky;
+            m = el->num_nodes;
+            for (j=0; j<m; j++)
+            {
+                k = (c*num_nodes + first_node[e] + j)*K + l;
+                h[k] = (j < m-1) ? el->h[j] : 0.;
+                kappa[k] = (j > 0 && j < m-1) ? el->kappa[j-1] : 0.;
+                temp_prev[k] = el->node_temp_prev[j];
+            }
+        }
+    }
+
+    for (c=0; c<num_chunks; c++)
+    {
+        n = (c < num_chunks-1) ? K : num_lanes - c*K;
+
+        // LU factorization of the tridiagonal element matrices (ISO 52016-1 equations (19)-(21))
+        for (e=0; e<num_elements; e++)
+        {
+            const int ke = (c*num_elements + e)*K;
+            const int kn = (c*num_nodes + first_node[e])*K;
+            m = first_node[e+1] - first_node[e];
+            for (j=0; j<m; j++)
+            {
+                k = kn + j*K;
+                for (l=0; l<n; l++)
+                {
+                    if (j == 0)
+                    {
+                        diag = h_ci[ke+l] + h_ri[ke+l] + h[k+l];
+                        inv_pivot[k+l] = 1./diag;
+                    }
+                    else
+                    {
+                        if (j < m-1) diag = kappa[k+l]/delta_t + h[k-K+l] + h[k+l];
+                        else diag = h_ext[ke+l] + h[k-K+l];
+                        inv_pivot[k+l] = 1./(diag - h[k-K+l]*inv_pivot[k-K+l]*h[k-K+l]);
+                    }
+                    response[k+l] = (j == 0) ? 1. : 0.;
+                }
+            }
+            solve_chain (response+kn, inv_pivot+kn, h+kn, m, n);
+        }
+
+        // The 2x2 system: ISO 52016-1 equation (17) for the air node and the
+        // definition of S, with the element chains eliminated
+        double *s = schur + c*4*K;
+        for (l=0; l<n; l++)
+        {
+            const int lane = c*K + l;
+            sum_area_hci = 0.;
+            for (e=0; e<num_elements; e++) sum_area_hci += area_hci[(c*num_elements + e)*K + l];
+            s[l] = c_int[lane] + sum_area_hci + Household::hh[household[lane]].heat_transfer_vent;
+            s[K+l] = 0.;
+            s[2*K+l] = 0.;
+            s[3*K+l] = 1.;
+            for (e=0; e<num_elements; e++)
+            {
+                k = (c*num_elements + e)*K + l;
+                r_0 = response[(c*num_nodes + first_node[e])*K + l];
+                s[l]     -= area_hci[k] * r_0 * h_ci[k];
+                s[K+l]   -= area_hci[k] * r_0 * h_ri[k]/area_tot[lane];
+                s[2*K+l] -= area[k] * r_0 * h_ci[k];
+                s[3*K+l] -= area[k] * r_0 * h_ri[k]/area_tot[lane];
+            }
+        }
+    }
+
+    // The model is linear in phi_HC, so that the temperatures for any heating or
+    // cooling power follow from the solution without it and the response to 1 W
+    if (config->thermal_superposition)
+    {
+        double zero[K], one[K];
+        for (l=0; l<K; l++)
+        {
+            zero[l] = 0.;
+            one[l] = 1.;
+        }
+        alloc_memory (&unit_air, num_chunks*K, function_name);
+        alloc_memory (&unit_op, num_chunks*K, function_name);
+        alloc_memory (&unit_temp, num_chunks*num_nodes*K, function_name);
+        for (c=0; c<num_chunks; c++)
+        {
+            n = (c < num_chunks-1) ? K : num_lanes - c*K;
+            solve (c, n, unit_temp + c*num_nodes*K, zero, zero, one, unit_air + c*K, unit_op + c*K, false);
+        }
+    }
+}
+
+
+// Calculate the node temperatures (temp) of the first n lanes of a chunk for the
+// heating (> 0) or cooling (< 0) power phi_HC. All arrays are indexed by lane%K.
+// Without sources the previous node temperatures and the outside temperature
+// are taken to be 0, i.e. the result depends on the arguments only.
+
+void ThermalBatch::solve (int chunk, int n, double *temp, const double temp_air_prev[], const double phi_int[],
+                          const double phi_HC[], double temp_air[], double temp_op[], bool sources)
+{
+    const double f_int_c = 0.4;               // ISO 52016-1 table B.11
+    const double f_sol_c = 0.4;               // ISO 52016-1 table B.11
+    const double f_HC_c = 0.4;                // ISO 52016-1 table B.11
+    const double phi_sol = 0.;
+    const double temp_ext = location->temperature;
+    const double *c_int_c = c_int + chunk*K;
+    const double *area_tot_c = area_tot + chunk*K;
+    const double *s = schur + chunk*4*K;
+    double value[K], b_air[K], b_surface[K], sum[K], coupling[K];
+    double *x;
+    const double *x_prev, *p, *q;
+    int e, j, m, ke, kn;
+
+#pragma omp simd
+    for (int l=0; l<n; l++)
+    {
+        value[l] = ((1-f_int_c)*phi_int[l] + (1-f_sol_c)*phi_sol + (1-f_HC_c)*phi_HC[l]) / area_tot_c[l];
+        b_air[l] = c_int_c[l]*temp_air_prev[l] + f_int_c*phi_int[l] + f_sol_c*phi_sol + f_HC_c*phi_HC[l];
+        b_surface[l] = 0.;
+    }
+
+    // Solve the element chains without the coupling to the air node and to S
+    for (e=0; e<num_elements; e++)
+    {
+        m = first_node[e+1] - first_node[e];
+        ke = (chunk*num_elements + e)*K;
+        kn = (chunk*num_nodes + first_node[e])*K;
+        x = temp + first_node[e]*K;
+        x_prev = temp_prev + kn;
+#pragma omp simd
+        for (int l=0; l<n; l++) x[l] = value[l];
+        if (sources)
+        {
+            for (j=1; j<m-1; j++)
+            {
+                p = kappa + kn + j*K;
+#pragma omp simd
+                for (int l=0; l<n; l++) x[j*K+l] = x_prev[j*K+l] * p[l]/delta_t;
+            }
+            p = h_ext + ke;
+            q = phi_sky + ke;
+#pragma omp simd
+            for (int l=0; l<n; l++) x[(m-1)*K+l] = p[l] * temp_ext - q[l];
+        }
+        else
+        {
+            for (j=1; j<m; j++)
+            {
+#pragma omp simd
+                for (int l=0; l<n; l++) x[j*K+l] = 0.;
+            }
+        }
+        solve_chain (x, inv_pivot+kn, h+kn, m, n);
+        p = area_hci + ke;
+        q = area + ke;
+#pragma omp simd
+        for (int l=0; l<n; l++)
+        {
+            b_air[l] += p[l] * x[l];
+            b_surface[l] += q[l] * x[l];
+        }
+    }
+
+    // Solve the 2x2 system and add the coupling to the element solutions
+#pragma omp simd
+    for (int l=0; l<n; l++)
+    {
+        double det = s[l]*s[3*K+l] - s[K+l]*s[2*K+l];
+        temp_air[l] = (b_air[l]*s[3*K+l] - s[K+l]*b_surface[l]) / det;
+        sum[l] = (s[l]*b_surface[l] - s[2*K+l]*b_air[l]) / det;
+        temp_op[l] = 0.5 * (temp_air[l] + sum[l]/area_tot_c[l]);
+    }
+    for (e=0; e<num_elements; e++)
+    {
+        m = first_node[e+1] - first_node[e];
+        ke = (chunk*num_elements + e)*K;
+        kn = (chunk*num_nodes + first_node[e])*K;
+        p = h_ci + ke;
+        q = h_ri + ke;
+#pragma omp simd
+        for (int l=0; l<n; l++) coupling[l] = p[l]*temp_air[l] + q[l]*sum[l]/area_tot_c[l];
+        for (j=0; j<m; j++)
+        {
+            x = temp + (first_node[e]+j)*K;
+            p = response + kn + j*K;
+#pragma omp simd
+            for (int l=0; l<n; l++) x[l] += p[l] * coupling[l];
+        }
+    }
+}
+
+
+// Space heating and cooling demand of the households of a chunk according to ISO 52016-1.
+// Each household needs at most three solutions: without heating or cooling, with the
+// maximum power of the heating or cooling system and with the power actually needed.
+// They are calculated for all lanes of the chunk at once, with thermal_superposition
+// the last two are derived from the first one. temp is work space for the node
+// temperatures of the chunk.
+
+void ThermalBatch::simulate (int chunk, double *temp)
+{
+    const int n = (chunk < num_chunks-1) ? K : num_lanes - chunk*K;
+    const int *hh_index = household + chunk*K;
+    double temp_air_prev[K], phi_int[K], phi_HC[K];
+    double temp_air[K], temp_op_0[K], temp_op_upper[K];
+    int mode[K];        // 0: neither heating nor cooling, 1: heating, 2: cooling
+    bool active = false;
+    Household *hp;
+
+    for (int l=0; l<n; l++)
+    {
+        hp = Household::hh + hh_index[l];
+        temp_air_prev[l] = hp->temp_int_air_prev;
+        phi_int[l] = hp->residents_at_home (sim_clock->daytime) * 5. * 2. * (32.-hp->temp_int_air_prev) + hp->heat_loss_app * 1000.;
+        phi_HC[l] = 0.;
+    }
+    solve (chunk, n, temp, temp_air_prev, phi_int, phi_HC, temp_air, temp_op_0);  // without any heating or cooling
+
+    for (int l=0; l<n; l++)
+    {
+        hp = Household::hh + hh_index[l];
+        hp->heat_demand_SH = hp->cool_demand = 0.;
+        mode[l] = 0;
+        if (temp_op_0[l] < hp->temp_int_set_H && sim_clock->heating_period)  // activation of the heating is required
+        {
+            mode[l] = 1;
+            phi_HC[l] = hp->max_heat_power * 1000.;
+        }
+        else if (hp->aircon && temp_op_0[l] > hp->temp_int_set_C)  // aircon available && cooling needed ?
+        {
+            mode[l] = 2;
+            phi_HC[l] = -hp->max_cool_power * 1000.;
+        }
+        if (mode[l]) active = true;
+    }
+    if (active)
+    {
+        // heating or cooling at max. power
+        if (config->thermal_superposition)
+        {
+            const double *u_op = unit_op + chunk*K;
+#pragma omp simd
+            for (int l=0; l<n; l++) temp_op_upper[l] = temp_op_0[l] + phi_HC[l]*u_op[l];
+        }
+        else solve (chunk, n, temp, temp_air_prev, phi_int, phi_HC, temp_air, temp_op_upper);
+        for (int l=0; l<n; l++)
+        {
+            hp = Household::hh + hh_index[l];
+            if (mode[l] == 1)
+            {
+                if (temp_op_upper[l] < hp->temp_int_set_H)
+                {
+                    hp->heat_demand_SH = hp->max_heat_power;
+                }
+                else
+                {
+                    hp->heat_demand_SH = hp->max_heat_power * (hp->temp_int_set_H - temp_op_0[l]) / (temp_op_upper[l] - temp_op_0[l]);
+                    phi_HC[l] = hp->heat_demand_SH * 1000.;
+                }
+            }
+            else if (mode[l] == 2)
+            {
+                if (temp_op_upper[l] > hp->temp_int_set_C)
+                {
+                    hp->cool_demand = hp->max_cool_power;
+                }
+                else
+                {
+                    hp->cool_demand = hp->max_cool_power * (temp_op_0[l] - hp->temp_int_set_C) / (temp_op_0[l] - temp_op_upper[l]);
+                    phi_HC[l] = -hp->cool_demand * 1000.;
+                }
+            }
+        }
+        // temperatures for the actual amount of heating or cooling power
+        if (config->thermal_superposition)
+        {
+            const double *u_air = unit_air + chunk*K;
+            const double *u_temp = unit_temp + chunk*num_nodes*K;
+#pragma omp simd
+            for (int l=0; l<n; l++) temp_air[l] += phi_HC[l]*u_air[l];
+            for (int j=0; j<num_nodes; j++)
+            {
+#pragma omp simd
+                for (int l=0; l<n; l++) temp[j*K+l] += phi_HC[l]*u_temp[j*K+l];
+            }
+        }
+        else solve (chunk, n, temp, temp_air_prev, phi_int, phi_HC, temp_air, temp_op_upper);
+    }
+
+    // save temperatures for the next timestep
+    for (int l=0; l<n; l++)
+    {
+        hp = Household::hh + hh_index[l];
+        hp->temp_int_air = hp->temp_int_air_prev = temp_air[l];
+    }
+    double *x_prev = temp_prev + chunk*num_nodes*K;
+    for (int j=0; j<num_nodes; j++)
+    {
+#pragma omp simd
+        for (int l=0; l<n; l++) x_prev[j*K+l] = temp[j*K+l];
+    }
+}
+
+
+// Called by all threads of the team once the set temperatures of all households
+// are known (see Household::run_1st_pass). The batches are set up the first time,
+// because the ventilation losses are known only then.
+
+void ThermalBatch::simulate()
+{
+    double *temp;
+
+#pragma omp single
+    {
+        if (task_batch == NULL) setup();
+    }
+    alloc_memory (&temp, max_nodes*K, "ThermalBatch::simulate");
+#pragma omp for schedule(static)
+    for (int t=0; t<num_tasks; t++) batch[task_batch[t]].simulate (task_chunk[t], temp);
+    delete [] temp;
+}
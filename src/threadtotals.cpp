@@ -0,0 +1,137 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "threadtotals.H"
+#include "proto.H"
+
+
+double** ThreadTotals::copy = NULL;
+int ThreadTotals::length[k_max_thread_totals];
+int ThreadTotals::num_totals = 0;
+int ThreadTotals::max_threads = 0;
+int ThreadTotals::next = 0;
+
+
+// Called before the first parallel region, once the number of threads is known
+
+void ThreadTotals::allocate_memory()
+{
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+    alloc_memory (&copy, max_threads*k_max_thread_totals, "ThreadTotals::allocate_memory");
+#endif
+}
+
+
+void ThreadTotals::deallocate_memory()
+{
+    delete [] copy;
+    copy = NULL;
+    max_threads = 0;
+}
+
+
+// Every thread of the team calls begin() at the beginning of a parallel region
+// and then add() for each total with the address of its own copy, all threads
+// in the same order.
+
+void ThreadTotals::begin()
+{
+    next = 0;
+}
+
+
+void ThreadTotals::add (double *total, int n)
+{
+#ifdef _OPENMP
+    int thread = omp_get_thread_num();
+
+    if (next == k_max_thread_totals || thread >= max_threads)
+    {
+        fprintf (stderr, "ThreadTotals::add: too many totals or threads\n");
+        exit (1);
+    }
+    copy[thread*k_max_thread_totals + next] = total;
+    if (thread == 0)
+    {
+        length[next] = n;
+        num_totals = next + 1;
+    }
+    next++;
+#else
+    (void)total;
+    (void)n;
+#endif
+}
+
+
+// Called by all threads of the team right after the barrier at the end of a pass
+
+void ThreadTotals::combine()
+{
+#ifdef _OPENMP
+    int num_threads = omp_get_num_threads();
+
+    if (num_threads == 1) return;
+#pragma omp master
+    for (int k=0; k<num_totals; k++)
+    {
+        double *total = copy[k];
+        for (int t=1; t<num_threads; t++)
+        {
+            double *partial = copy[t*k_max_thread_totals + k];
+            for (int i=0; i<length[k]; i++)
+            {
+                total[i] += partial[i];
+                partial[i] = 0.;
+            }
+        }
+    }
+#pragma omp barrier
+#endif
+}
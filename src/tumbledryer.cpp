@@ -52,8 +52,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 TumbleDryer::TumbleDryer (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     status = OFF;
     timer = 0;
@@ -100,7 +98,7 @@ void TumbleDryer::simulate (double time)
     double daytime = sim_clock->daytime;
     int best_start, best_end;
 
-    timer--;
+    timer -= wake_up();
 
     // If the machine is idle
     // and there is some laundry waiting to be dried
@@ -158,4 +156,9 @@ void TumbleDryer::simulate (double time)
         increase_consumption();
         household->heat_loss_app += power.real*0.1;
     }
+    if (status == OFF)
+    {
+        if (timer > 0) sleep (timer);
+        else if (laundry <= 0.) sleep (steps_per_day());  // or until add_laundry()
+    }
 }
@@ -54,8 +54,6 @@ TV::TV (Household *hh, int tv_rank)
     double area, diag;
 
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     status = OFF;
     household = hh;
     rank = tv_rank;
@@ -109,7 +107,7 @@ void TV::simulate()
     int rnd;
     double rahd, rt;
 
-    timer--;
+    timer -= wake_up();
 
     // At the beginning of each day decide for how long and when
     // to turn on the TV
@@ -207,4 +205,5 @@ void TV::simulate()
         increase_consumption (corr_factor);
         household->heat_loss_app += power.real * corr_factor;
     }
+    if (status == OFF) sleep (steps_until (time_1, time_2));
 }
@@ -51,8 +51,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 Vacuum::Vacuum (Household *hh)
 {
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     status = OFF;
     timer = 0;
@@ -97,7 +95,7 @@ void Vacuum::simulate()
 {
     double corr_factor = 1.0, duration;
 
-    timer--;
+    timer -= wake_up();
 
 //  Do we want to vacuum clean today?
     if (sim_clock->midnight && status == OFF)
@@ -141,4 +139,5 @@ void Vacuum::simulate()
         increase_consumption (corr_factor);
         household->heat_loss_app += power.real*0.5*corr_factor;
     }
+    if (status == OFF) sleep (timer > 0 ? timer : steps_per_day());
 }
@@ -61,7 +61,7 @@ WashingMachine::WashingMachine (Household *hh)
     num_energy_classes = config->wmachine.num_energy_classes;
     static double *sec_per_cycle = NULL;
     alloc_memory (&sec_per_cycle, num_energy_classes, "WashingMachine");
-    if (config->variable_load && first_app == NULL) // the first washing machine inits the variable load
+    if (config->variable_load && variable_load == NULL) // the first washing machine inits the variable load
     {
         FILE *fp = NULL;
         char *buffer = NULL;
@@ -160,8 +160,6 @@ WashingMachine::WashingMachine (Household *hh)
         free (tokens);
     }
     count[hh->residents]++;
-    next_app = first_app;
-    first_app = this;
     household = hh;
     status = OFF;
     timer = 0;
@@ -209,7 +207,7 @@ void WashingMachine::simulate (double time)
     int intervals[20], num_intervals, i;
     int best_start, best_end;
 
-    timer--;
+    timer -= wake_up();
 
     // If the machine is idle
     // and there is some laundry to wash
@@ -335,6 +333,12 @@ void WashingMachine::simulate (double time)
         increase_consumption();
         household->heat_loss_app += power.real*0.1;
     }
+    if (status == OFF && !smart_mode)
+    {
+        // the residents may start the machine when they wake up
+        int steps = steps_until (household->wakeup);
+        sleep (timer > 0 && timer < steps ? timer : steps);
+    }
 }
 
 
@@ -0,0 +1,264 @@
+/*---------------------------------------------------------------------------
+ _____   ______  ______         _____   _____   _____   ______ _____  _____
+|_____/ |______ |_____  |      |     | |_____| |     \ |_____    |   |  |  |
+|    \_ |______ ______| |_____ |_____| |     | |_____/ ______| __|__ |  |  |
+
+|.....................|  The Residential Load Simulator
+|.......*..*..*.......|
+|.....*.........*.....|  Authors: Christoph Troyer
+|....*...........*....|
+|.....*.........*.....|
+|.......*..*..*.......|
+|.....................|
+
+Copyright (c) 2021 European Union
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+
+---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "proto.H"
+#include "writer.H"
+
+// The counters 'head' and 'tail' are only ever increased, their difference is
+// the number of jobs waiting in the ring buffer. Each counter is written by one
+// thread only. The release/acquire pairs make sure that a job is complete before
+// the other thread sees the changed counter.
+//
+// A thread which is going to sleep sets its 'waiting' flag while holding the
+// mutex and then checks the counters once more. The other thread changes the
+// counter first and checks the flag afterwards (both sequentially consistent),
+// so at least one of them sees the change of the other. Only then the mutex is
+// taken to signal, the rows of a busy writer thread are passed without it.
+
+
+Writer::Writer()
+{
+    ring = NULL;
+    head = tail = 0;
+    running = false;
+    stop_requested = false;
+    writer_waiting = simulation_waiting = false;
+}
+
+
+Writer::~Writer()
+{
+    stop();
+}
+
+
+void Writer::start()
+{
+#ifdef HAVE_PTHREAD
+    if (running) return;
+    alloc_memory (&ring, k_writer_slots, "Writer::start");
+    head = tail = 0;
+    stop_requested = false;
+    writer_waiting = simulation_waiting = false;
+    pthread_mutex_init (&mutex, NULL);
+    pthread_cond_init (&jobs_added, NULL);
+    pthread_cond_init (&jobs_done, NULL);
+    if (pthread_create (&thread, NULL, loop, this))
+    {
+        fprintf (stderr, "\nWARNING: Cannot start the output thread, the output is written synchronously.\n");
+        pthread_cond_destroy (&jobs_done);
+        pthread_cond_destroy (&jobs_added);
+        pthread_mutex_destroy (&mutex);
+        delete [] ring;
+        ring = NULL;
+        return;
+    }
+    running = true;
+#endif
+}
+
+
+// Wait until all jobs are done and terminate the writer thread
+
+void Writer::stop()
+{
+#ifdef HAVE_PTHREAD
+    if (!running) return;
+    pthread_mutex_lock (&mutex);
+    stop_requested.store (true, std::memory_order_release);
+    pthread_cond_signal (&jobs_added);
+    pthread_mutex_unlock (&mutex);
+    pthread_join (thread, NULL);
+    running = false;
+    pthread_cond_destroy (&jobs_done);
+    pthread_cond_destroy (&jobs_added);
+    pthread_mutex_destroy (&mutex);
+    delete [] ring;
+    ring = NULL;
+#endif
+}
+
+
+// Wait until all jobs added so far are done, e.g. before the size of
+// the files is stored in a checkpoint
+
+void Writer::sync()
+{
+#ifdef HAVE_PTHREAD
+    if (!running) return;
+    unsigned int h = head.load (std::memory_order_relaxed);
+    if (tail.load (std::memory_order_acquire) == h) return;
+    pthread_mutex_lock (&mutex);
+    simulation_waiting = true;
+    while (tail.load() != h) pthread_cond_wait (&jobs_done, &mutex);
+    simulation_waiting = false;
+    pthread_mutex_unlock (&mutex);
+#endif
+}
+
+
+// The writer thread sleeps until there are new jobs. After each batch of jobs
+// it wakes up the simulation thread, if that one waits for free slots or in
+// sync().
+
+#ifdef HAVE_PTHREAD
+void *Writer::loop (void *arg)
+{
+    Writer *w = (Writer *)arg;
+    unsigned int t = w->tail.load (std::memory_order_relaxed);
+
+    while (true)
+    {
+        unsigned int h = w->head.load (std::memory_order_acquire);
+        if (t == h)
+        {
+            bool finished;
+            pthread_mutex_lock (&w->mutex);
+            w->writer_waiting = true;
+            while (t == w->head.load() && !w->stop_requested.load (std::memory_order_acquire))
+                pthread_cond_wait (&w->jobs_added, &w->mutex);
+            w->writer_waiting = false;
+            // The simulation thread sets 'stop_requested' after its last job
+            finished = t == w->head.load (std::memory_order_acquire);
+            pthread_mutex_unlock (&w->mutex);
+            if (finished) break;
+            continue;
+        }
+        while (t != h)
+        {
+            execute (w->ring + (t & (k_writer_slots-1)));
+            t++;
+            w->tail.store (t);
+        }
+        if (w->simulation_waiting.load())
+        {
+            pthread_mutex_lock (&w->mutex);
+            pthread_cond_signal (&w->jobs_done);
+            pthread_mutex_unlock (&w->mutex);
+        }
+    }
+    return NULL;
+}
+#endif
+
+
+// Return the next free slot of the ring buffer. If the writer thread is
+// lagging behind, the simulation waits here.
+
+Writer::Job *Writer::new_job()
+{
+    unsigned int h = head.load (std::memory_order_relaxed);
+#ifdef HAVE_PTHREAD
+    if (h - tail.load (std::memory_order_acquire) == k_writer_slots)
+    {
+        pthread_mutex_lock (&mutex);
+        simulation_waiting = true;
+        while (h - tail.load() == k_writer_slots) pthread_cond_wait (&jobs_done, &mutex);
+        simulation_waiting = false;
+        pthread_mutex_unlock (&mutex);
+    }
+#endif
+    return ring + (h & (k_writer_slots-1));
+}
+
+
+void Writer::submit()
+{
+    head.store (head.load (std::memory_order_relaxed) + 1);
+#ifdef HAVE_PTHREAD
+    if (writer_waiting.load())
+    {
+        pthread_mutex_lock (&mutex);
+        pthread_cond_signal (&jobs_added);
+        pthread_mutex_unlock (&mutex);
+    }
+#endif
+}
+
+
+void Writer::execute (const Job *job)
+{
+    if (job->num_values < 0) fclose (job->file);
+    else write_series_row (job->file, job->values, job->num_values, job->integer_columns);
+}
+
+
+// Append one row to a time series file (see write_series_row())
+
+void Writer::row (FILE *file, const double values[], int num_values, unsigned int integer_columns)
+{
+    if (!running)
+    {
+        write_series_row (file, values, num_values, integer_columns);
+        return;
+    }
+    if (num_values > k_writer_max_values)
+    {
+        fprintf (stderr, "Writer::row: Cannot write more than %d values per row.\n", k_writer_max_values);
+        exit (1);
+    }
+    Job *job = new_job();
+    job->file = file;
+    job->num_values = num_values;
+    job->integer_columns = integer_columns;
+    for (int i=0; i<num_values; i++) job->values[i] = values[i];
+    submit();
+}
+
+
+// Close a file after all rows added so far have been written
+
+void Writer::close (FILE *file)
+{
+    if (!running)
+    {
+        fclose (file);
+        return;
+    }
+    Job *job = new_job();
+    job->file = file;
+    job->num_values = -1;
+    submit();
+}